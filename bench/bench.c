@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "tdmm.h"
+#include "freescan.h"
+
+// Synthetic workload benchmark. Every allocator replays the same
+// pre-generated operation stream, timed with CLOCK_MONOTONIC over batches
+// of BATCH_OPS operations so the clock itself stays out of the numbers.
+// Latency percentiles are taken over the per-operation average of each
+// batch. Usage: tdmm_bench [allocator|all] [ops] [max-live]
+
+#define DEFAULT_OPS 2000000
+#define DEFAULT_LIVE 20000   // most objects alive at once
+#define BATCH_OPS 16         // operations per timed batch
+#define MIN_SIZE 16
+#define UNIFORM_MAX 4096
+#define POWER_MAX 65536
+#define POWER_ALPHA 1.5      // Pareto shape for power-law sizes
+
+typedef enum { SIZES_UNIFORM, SIZES_POWER } size_dist_e;
+typedef enum { LIFE_LIFO, LIFE_FIFO, LIFE_RANDOM } lifetime_e;
+
+typedef struct {
+    const char *name;
+    size_dist_e sizes;
+    lifetime_e lifetime;
+} workload_t;
+
+static const workload_t workloads[] = {
+    { "uniform-lifo",   SIZES_UNIFORM, LIFE_LIFO },
+    { "uniform-fifo",   SIZES_UNIFORM, LIFE_FIFO },
+    { "uniform-random", SIZES_UNIFORM, LIFE_RANDOM },
+    { "power-lifo",     SIZES_POWER,   LIFE_LIFO },
+    { "power-fifo",     SIZES_POWER,   LIFE_FIFO },
+    { "power-random",   SIZES_POWER,   LIFE_RANDOM },
+};
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+// One allocator under test; glibc is the baseline
+typedef struct {
+    const char *name;
+    int tdmm;               // 0 for glibc
+    alloc_strat_e strategy;
+} allocator_t;
+
+static const allocator_t allocators[] = {
+    { "glibc",      0, FIRST_FIT },
+    { "first",      1, FIRST_FIT },
+    { "best",       1, BEST_FIT },
+    { "worst",      1, WORST_FIT },
+    { "buddy",      1, BUDDY },
+    { "sequential", 1, SEQUENTIAL },
+    { "random",     1, RANDOM },
+    { "adaptive",   1, ADAPTIVE },
+};
+#define NUM_ALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+// Pre-generated operation stream: size > 0 allocates, size == 0 frees the
+// object the lifetime policy picks; pick is the random slot for LIFE_RANDOM.
+typedef struct {
+    uint32_t size;
+    uint32_t pick;
+} op_t;
+
+static uint64_t rng_state = 0x2545F4914F6CDD1Dull;
+
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double unit_random(void) {
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t draw_size(size_dist_e dist) {
+    if (dist == SIZES_UNIFORM)
+        return MIN_SIZE + (uint32_t)(next_random() % (UNIFORM_MAX - MIN_SIZE + 1));
+    // inverse-transform sample of a Pareto distribution, cut off at POWER_MAX
+    double size = MIN_SIZE / pow(1.0 - unit_random(), 1.0 / POWER_ALPHA);
+    return size > POWER_MAX ? POWER_MAX : (uint32_t)size;
+}
+
+// Allocations and frees alternate at random around a live set that stays
+// between empty and max_live objects.
+static void generate_ops(op_t *ops, size_t count, size_t max_live, size_dist_e dist) {
+    size_t live = 0;
+    for (size_t i = 0; i < count; i++) {
+        int allocate = live == 0 || (live < max_live && (next_random() & 1));
+        if (allocate) {
+            ops[i].size = draw_size(dist);
+            live++;
+        } else {
+            ops[i].size = 0;
+            live--;
+        }
+        ops[i].pick = (uint32_t)next_random();
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *bench_malloc(const allocator_t *a, size_t size) {
+    return a->tdmm ? t_malloc(size) : malloc(size);
+}
+
+static void bench_free(const allocator_t *a, void *ptr) {
+    if (a->tdmm)
+        t_free(ptr);
+    else
+        free(ptr);
+}
+
+static int compare_double(const void *x, const void *y) {
+    double a = *(const double *)x, b = *(const double *)y;
+    return (a > b) - (a < b);
+}
+
+// Live objects as a ring: LIFO takes from the tail, FIFO from the head,
+// RANDOM swaps a random one to the tail first.
+typedef struct {
+    void **slots;
+    size_t capacity;
+    size_t head;
+    size_t count;
+} live_set_t;
+
+static void *live_take(live_set_t *set, lifetime_e lifetime, uint32_t pick) {
+    size_t tail = (set->head + set->count - 1) % set->capacity;
+    if (lifetime == LIFE_FIFO) {
+        void *ptr = set->slots[set->head];
+        set->head = (set->head + 1) % set->capacity;
+        set->count--;
+        return ptr;
+    }
+    if (lifetime == LIFE_RANDOM) {
+        size_t at = (set->head + pick % set->count) % set->capacity;
+        void *tmp = set->slots[at];
+        set->slots[at] = set->slots[tail];
+        set->slots[tail] = tmp;
+    }
+    set->count--;
+    return set->slots[tail];
+}
+
+static void live_put(live_set_t *set, void *ptr) {
+    set->slots[(set->head + set->count) % set->capacity] = ptr;
+    set->count++;
+}
+
+// Runs the stream once; fills batch_ns with the per-op time of each batch.
+// Returns the total time in ns, or a negative value if an allocation failed.
+static double run_ops(const allocator_t *a, const op_t *ops, size_t count,
+                      lifetime_e lifetime, live_set_t *set, double *batch_ns) {
+    double total = 0;
+    for (size_t start = 0; start < count; start += BATCH_OPS) {
+        size_t end = start + BATCH_OPS < count ? start + BATCH_OPS : count;
+        double t0 = now_ns();
+        for (size_t i = start; i < end; i++) {
+            if (ops[i].size) {
+                char *ptr = bench_malloc(a, ops[i].size);
+                if (!ptr)
+                    return -1;
+                ptr[0] = (char)i;  // touch it, as a real caller would
+                live_put(set, ptr);
+            } else {
+                bench_free(a, live_take(set, lifetime, ops[i].pick));
+            }
+        }
+        double elapsed = now_ns() - t0;
+        batch_ns[start / BATCH_OPS] = elapsed / (double)(end - start);
+        total += elapsed;
+    }
+    // leave the heap empty for the next run
+    while (set->count > 0)
+        bench_free(a, live_take(set, LIFE_LIFO, 0));
+    set->head = 0;
+    return total;
+}
+
+static int select_allocator(const char *filter, const allocator_t *a) {
+    return filter == NULL || strcmp(filter, "all") == 0 || strcmp(filter, a->name) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    size_t count = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_OPS;
+    size_t max_live = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_LIVE;
+    if (count == 0 || max_live == 0) {
+        fprintf(stderr, "usage: %s [all|glibc|first|best|worst|buddy|sequential|random|adaptive] [ops] [max-live]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t batches = (count + BATCH_OPS - 1) / BATCH_OPS;
+    op_t *ops = malloc(count * sizeof(op_t));
+    double *batch_ns = malloc(batches * sizeof(double));
+    live_set_t set = { malloc(max_live * sizeof(void *)), max_live, 0, 0 };
+    if (!ops || !batch_ns || !set.slots) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    // TDMM_SIMD picks a narrower free-list scan; say which one ran
+    printf("%zu ops per run, up to %zu live objects, %d ops per timed batch, %s free-list scan\n",
+           count, max_live, BATCH_OPS, freeScanName());
+    printf("%-15s %-11s %10s %9s %9s %9s\n",
+           "workload", "allocator", "Mops/s", "p50(ns)", "p99(ns)", "p999(ns)");
+
+    for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+        rng_state = 0x2545F4914F6CDD1Dull + w;
+        generate_ops(ops, count, max_live, workloads[w].sizes);
+
+        for (size_t i = 0; i < NUM_ALLOCATORS; i++) {
+            const allocator_t *a = &allocators[i];
+            if (!select_allocator(filter, a))
+                continue;
+            if (a->tdmm)
+                t_init(a->strategy);
+
+            double total = run_ops(a, ops, count, workloads[w].lifetime, &set, batch_ns);
+            if (total < 0) {
+                printf("%-15s %-11s allocation failed\n", workloads[w].name, a->name);
+                set.count = 0;
+                set.head = 0;
+                continue;
+            }
+            qsort(batch_ns, batches, sizeof(double), compare_double);
+            printf("%-15s %-11s %10.2f %9.1f %9.1f %9.1f\n",
+                   workloads[w].name, a->name, count / total * 1e3,
+                   batch_ns[batches / 2],
+                   batch_ns[(size_t)(batches * 0.99)],
+                   batch_ns[(size_t)(batches * 0.999)]);
+            fflush(stdout);
+        }
+    }
+
+    free(set.slots);
+    free(batch_ns);
+    free(ops);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,407 @@
+#define _GNU_SOURCE  // pthread_tryjoin_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tdmm.h"
+
+// Multi-threaded allocator benchmarks, each run for every allocator over a
+// sweep of thread counts:
+//   threadtest     every thread allocates and frees batches of its own objects
+//   larson         server simulation: threads replace random objects in a
+//                  shared set and hand their part of it on every round, so
+//                  most frees are of objects another thread allocated
+//   prodcons       pairs of threads; one allocates, the other frees
+//   cache-scratch  threads get one object each from the same thread, free it,
+//                  then allocate, write and free small objects in a loop
+// The total work of a run is fixed and split among the threads.
+//
+// RSS is sampled every millisecond while a run goes on; RSS+ is its peak
+// growth over the run, setup included, and blowup that growth divided by
+// the bytes the workload keeps live.
+// For cache-scratch, "shared" counts threads whose first object lies on a
+// cache line with another thread's, which is the false sharing an
+// allocator causes whether or not the machine has the cores to show it.
+// Usage: tdmm_mtbench [allocator|all] [max-threads] [ops]
+
+#define DEFAULT_OPS 2000000
+#define DEFAULT_MAX_THREADS 8
+#define MAX_THREADS 256
+#define CACHE_LINE 64
+
+#define TT_OBJECTS 1000     // threadtest batch
+#define TT_SIZE 64
+#define LARSON_SLOTS 1000   // objects per thread in the shared set
+#define LARSON_ROUNDS 10    // hand-offs per run
+#define LARSON_MIN 16
+#define LARSON_MAX 1024
+#define PC_RING 256         // objects in flight per pair
+#define PC_MIN 16
+#define PC_MAX 512
+#define SCRATCH_SIZE 8
+#define SCRATCH_WRITES 100  // writes per allocated object
+
+typedef struct {
+    const char *name;
+    int tdmm;               // 0 for glibc
+    alloc_strat_e strategy;
+} allocator_t;
+
+static const allocator_t allocators[] = {
+    { "glibc",      0, FIRST_FIT },
+    { "first",      1, FIRST_FIT },
+    { "best",       1, BEST_FIT },
+    { "worst",      1, WORST_FIT },
+    { "buddy",      1, BUDDY },
+    { "sequential", 1, SEQUENTIAL },
+    { "random",     1, RANDOM },
+    { "adaptive",   1, ADAPTIVE },
+};
+#define NUM_ALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+// single-producer single-consumer ring; the indices sit on their own lines
+typedef struct {
+    void *slots[PC_RING];
+    _Alignas(CACHE_LINE) size_t head;   // next slot to take, consumer only
+    _Alignas(CACHE_LINE) size_t tail;   // next slot to fill, producer only
+} ring_t;
+
+struct run;
+
+typedef struct {
+    struct run *run;
+    int index;
+    size_t ops;             // allocations plus frees for this thread
+    uint64_t rng;
+    pthread_t thread;
+} worker_t;
+
+// one workload, one allocator, one thread count
+typedef struct run {
+    const allocator_t *a;
+    int threads;
+    pthread_barrier_t start;
+    pthread_barrier_t round;    // larson hand-off
+    void ***sets;               // larson: each thread's objects
+    ring_t *rings;              // prodcons: one per pair
+    void **scratch;             // cache-scratch: objects handed out
+    uintptr_t *first;           // cache-scratch: each thread's first object
+    worker_t workers[MAX_THREADS];
+} run_t;
+
+typedef struct {
+    const char *name;
+    void *(*body)(void *);
+    int (*threads)(int requested);  // threads the workload runs with
+    size_t (*setup)(run_t *run);    // returns the most bytes kept live
+    void (*teardown)(run_t *run);
+} workload_t;
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void *bench_malloc(const allocator_t *a, size_t size) {
+    return a->tdmm ? t_malloc(size) : malloc(size);
+}
+
+static void bench_free(const allocator_t *a, void *ptr) {
+    if (a->tdmm)
+        t_free(ptr);
+    else
+        free(ptr);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t current_rss(void) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    unsigned long pages = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &pages, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static int same_threads(int requested) {
+    return requested;
+}
+
+static int even_threads(int requested) {
+    return requested < 2 ? 2 : requested & ~1;
+}
+
+static void no_teardown(run_t *run) {
+    (void)run;
+}
+
+// --- threadtest ---
+
+static void *threadtest_body(void *arg) {
+    worker_t *w = arg;
+    const allocator_t *a = w->run->a;
+    void *batch[TT_OBJECTS];
+    pthread_barrier_wait(&w->run->start);
+    for (size_t done = 0; done < w->ops; done += 2 * TT_OBJECTS) {
+        for (int i = 0; i < TT_OBJECTS; i++) {
+            batch[i] = bench_malloc(a, TT_SIZE);
+            *(char *)batch[i] = (char)i;
+        }
+        for (int i = 0; i < TT_OBJECTS; i++)
+            bench_free(a, batch[i]);
+    }
+    return NULL;
+}
+
+static size_t threadtest_setup(run_t *run) {
+    return (size_t)run->threads * TT_OBJECTS * TT_SIZE;
+}
+
+// --- larson ---
+
+// The main thread fills the set, so the workers' first frees are remote too.
+static size_t larson_setup(run_t *run) {
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    size_t live = 0;
+    run->sets = malloc(run->threads * sizeof(void **));
+    for (int t = 0; t < run->threads; t++) {
+        run->sets[t] = malloc(LARSON_SLOTS * sizeof(void *));
+        for (int i = 0; i < LARSON_SLOTS; i++) {
+            uint32_t size = LARSON_MIN + next_random(&rng) % (LARSON_MAX - LARSON_MIN + 1);
+            run->sets[t][i] = bench_malloc(run->a, size);
+            live += size;
+        }
+    }
+    // replacements draw from the same sizes, so this stays about the same
+    return live;
+}
+
+static void *larson_body(void *arg) {
+    worker_t *w = arg;
+    run_t *run = w->run;
+    pthread_barrier_wait(&run->start);
+    size_t per_round = w->ops / 2 / LARSON_ROUNDS;
+    for (int r = 0; r < LARSON_ROUNDS; r++) {
+        // every thread moves on to the next part at once, so no part is shared
+        int part = (w->index + r) % run->threads;
+        void **set = run->sets[part];
+        for (size_t i = 0; i < per_round; i++) {
+            size_t slot = next_random(&w->rng) % LARSON_SLOTS;
+            uint32_t size = LARSON_MIN + next_random(&w->rng) % (LARSON_MAX - LARSON_MIN + 1);
+            bench_free(run->a, set[slot]);
+            set[slot] = bench_malloc(run->a, size);
+            *(char *)set[slot] = (char)i;
+        }
+        pthread_barrier_wait(&run->round);
+    }
+    return NULL;
+}
+
+static void larson_teardown(run_t *run) {
+    for (int t = 0; t < run->threads; t++) {
+        for (int i = 0; i < LARSON_SLOTS; i++)
+            bench_free(run->a, run->sets[t][i]);
+        free(run->sets[t]);
+    }
+    free(run->sets);
+}
+
+// --- prodcons ---
+
+static size_t prodcons_setup(run_t *run) {
+    int pairs = run->threads / 2;
+    run->rings = aligned_alloc(CACHE_LINE, pairs * sizeof(ring_t));
+    memset(run->rings, 0, pairs * sizeof(ring_t));
+    return (size_t)pairs * PC_RING * (PC_MIN + PC_MAX) / 2;
+}
+
+// Even workers produce for the odd worker after them. Waiting threads
+// yield, so pairs make progress even with fewer cores than threads.
+static void *prodcons_body(void *arg) {
+    worker_t *w = arg;
+    run_t *run = w->run;
+    ring_t *ring = &run->rings[w->index / 2];
+    size_t items = w->ops / 2;
+    pthread_barrier_wait(&run->start);
+    if (w->index % 2 == 0) {
+        for (size_t i = 0; i < items; i++) {
+            uint32_t size = PC_MIN + next_random(&w->rng) % (PC_MAX - PC_MIN + 1);
+            void *ptr = bench_malloc(run->a, size);
+            *(char *)ptr = (char)i;
+            size_t tail = ring->tail;
+            while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == PC_RING)
+                sched_yield();
+            ring->slots[tail % PC_RING] = ptr;
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    } else {
+        for (size_t i = 0; i < items; i++) {
+            size_t head = ring->head;
+            while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head)
+                sched_yield();
+            void *ptr = ring->slots[head % PC_RING];
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+            bench_free(run->a, ptr);
+        }
+    }
+    return NULL;
+}
+
+static void prodcons_teardown(run_t *run) {
+    free(run->rings);
+}
+
+// --- cache-scratch ---
+
+// All the objects come from one thread, so an allocator that hands out
+// neighbouring memory puts them on shared cache lines.
+static size_t scratch_setup(run_t *run) {
+    run->scratch = malloc(run->threads * sizeof(void *));
+    run->first = malloc(run->threads * sizeof(uintptr_t));
+    for (int t = 0; t < run->threads; t++)
+        run->scratch[t] = bench_malloc(run->a, SCRATCH_SIZE);
+    return 0;  // too little for a blowup figure to mean anything
+}
+
+static void *scratch_body(void *arg) {
+    worker_t *w = arg;
+    run_t *run = w->run;
+    pthread_barrier_wait(&run->start);
+    bench_free(run->a, run->scratch[w->index]);
+    for (size_t done = 0; done < w->ops; done += 2) {
+        volatile char *ptr = bench_malloc(run->a, SCRATCH_SIZE);
+        if (done == 0)
+            run->first[w->index] = (uintptr_t)ptr;
+        for (int i = 0; i < SCRATCH_WRITES; i++)
+            ptr[i % SCRATCH_SIZE]++;
+        bench_free(run->a, (void *)ptr);
+    }
+    return NULL;
+}
+
+static int shared_lines(const run_t *run) {
+    int shared = 0;
+    for (int i = 0; i < run->threads; i++) {
+        for (int j = 0; j < run->threads; j++) {
+            if (i != j && run->first[i] / CACHE_LINE == run->first[j] / CACHE_LINE) {
+                shared++;
+                break;
+            }
+        }
+    }
+    return shared;
+}
+
+static void scratch_teardown(run_t *run) {
+    free(run->scratch);
+    free(run->first);
+}
+
+static const workload_t workloads[] = {
+    { "threadtest",    threadtest_body, same_threads, threadtest_setup, no_teardown },
+    { "larson",        larson_body,     same_threads, larson_setup,     larson_teardown },
+    { "prodcons",      prodcons_body,   even_threads, prodcons_setup,   prodcons_teardown },
+    { "cache-scratch", scratch_body,    same_threads, scratch_setup,    scratch_teardown },
+};
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static void run_workload(const workload_t *workload, const allocator_t *a,
+                         int requested, size_t ops) {
+    static run_t run;
+    memset(&run, 0, sizeof(run));
+    run.a = a;
+    run.threads = workload->threads(requested);
+    if (a->tdmm)
+        t_init(a->strategy);
+
+    // the growth includes what setup allocates
+    size_t base_rss = current_rss();
+    size_t peak_rss = base_rss;
+    size_t live = workload->setup(&run);
+    pthread_barrier_init(&run.start, NULL, run.threads + 1);
+    pthread_barrier_init(&run.round, NULL, run.threads);
+    for (int t = 0; t < run.threads; t++) {
+        worker_t *w = &run.workers[t];
+        w->run = &run;
+        w->index = t;
+        w->ops = ops / run.threads;
+        w->rng = 0x2545F4914F6CDD1Dull + t;
+        pthread_create(&w->thread, NULL, workload->body, w);
+    }
+
+    pthread_barrier_wait(&run.start);
+    double t0 = now_ns();
+    // sample while the workers run; the last join ends the timing
+    for (int t = 0; t < run.threads; t++) {
+        while (pthread_tryjoin_np(run.workers[t].thread, NULL) != 0) {
+            size_t rss = current_rss();
+            if (rss > peak_rss)
+                peak_rss = rss;
+            struct timespec pause = { 0, 1000000 };
+            nanosleep(&pause, NULL);
+        }
+    }
+    double elapsed = now_ns() - t0;
+    size_t rss = current_rss();
+    if (rss > peak_rss)
+        peak_rss = rss;
+
+    char blowup[16] = "-", shared[16] = "-";
+    if (live > 0)
+        snprintf(blowup, sizeof(blowup), "%.2f", (double)(peak_rss - base_rss) / live);
+    if (workload->body == scratch_body)
+        snprintf(shared, sizeof(shared), "%d", shared_lines(&run));
+    size_t done = ops / run.threads * run.threads;
+    printf("%-14s %-11s %7d %10.2f %10.2f %8s %7s\n",
+           workload->name, a->name, run.threads, done / elapsed * 1e3,
+           (peak_rss - base_rss) / 1048576.0, blowup, shared);
+    fflush(stdout);
+
+    workload->teardown(&run);
+    pthread_barrier_destroy(&run.start);
+    pthread_barrier_destroy(&run.round);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    int max_threads = argc > 2 ? atoi(argv[2]) : DEFAULT_MAX_THREADS;
+    size_t ops = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_OPS;
+    if (max_threads < 1 || max_threads > MAX_THREADS || ops == 0) {
+        fprintf(stderr, "usage: %s [all|glibc|first|best|worst|buddy|sequential|random|adaptive] [max-threads] [ops]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu ops per run, threads 1..%d, %ld CPUs\n", ops, max_threads,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-14s %-11s %7s %10s %10s %8s %7s\n",
+           "workload", "allocator", "threads", "Mops/s", "RSS+(MB)", "blowup", "shared");
+
+    for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+        for (size_t i = 0; i < NUM_ALLOCATORS; i++) {
+            if (filter && strcmp(filter, "all") != 0 && strcmp(filter, allocators[i].name) != 0)
+                continue;
+            int last = 0;
+            for (int threads = 1; threads <= max_threads; threads *= 2) {
+                // the pair workloads round 1 up to 2; skip the repeat
+                if (workloads[w].threads(threads) == last)
+                    continue;
+                last = workloads[w].threads(threads);
+                run_workload(&workloads[w], &allocators[i], threads, ops);
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
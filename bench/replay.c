@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tdmm.h"
+#include "trace.h"
+
+// Replays a trace recorded with t_trace_start or TDMM_TRACE against each
+// allocator, at full speed: the recorded timing only fixes the order of
+// the events, merged across threads, and everything runs on one thread.
+// Usage: tdmm_replay <trace> [allocator|all]
+
+typedef struct {
+    const char *name;
+    int tdmm;               // 0 for glibc
+    alloc_strat_e strategy;
+} allocator_t;
+
+static const allocator_t allocators[] = {
+    { "glibc",      0, FIRST_FIT },
+    { "first",      1, FIRST_FIT },
+    { "best",       1, BEST_FIT },
+    { "worst",      1, WORST_FIT },
+    { "buddy",      1, BUDDY },
+    { "sequential", 1, SEQUENTIAL },
+    { "random",     1, RANDOM },
+    { "adaptive",   1, ADAPTIVE },
+};
+#define NUM_ALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+// One event with its absolute time rebuilt from the chunk's base. The
+// recorded addresses are replaced by object ids once the events are merged.
+typedef struct {
+    uint64_t time;
+    uint64_t ptr;
+    uint64_t old_ptr;
+    size_t size;
+    size_t seq;             // position in the file, to keep a thread's order
+    uint32_t thread;
+    uint32_t id;
+    uint8_t op;
+    uint8_t arg;
+} event_t;
+
+typedef struct {
+    event_t *events;
+    size_t count;
+    uint32_t max_id;
+    uint32_t threads;
+} trace_t;
+
+// by time; threads record without a shared clock, so ties go by thread
+static int compare_event(const void *x, const void *y) {
+    const event_t *a = x, *b = y;
+    if (a->time != b->time)
+        return (a->time > b->time) - (a->time < b->time);
+    if (a->thread != b->thread)
+        return (a->thread > b->thread) - (a->thread < b->thread);
+    return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+// address -> id of the object living there, open addressing with linear
+// probing; ids are never 0
+typedef struct {
+    uint64_t *ptrs;
+    uint32_t *ids;
+    size_t capacity;        // a power of two
+    size_t count;
+} object_map_t;
+
+static size_t map_slot(const object_map_t *map, uint64_t ptr) {
+    return (size_t)(((ptr >> 4) * 0x9E3779B97F4A7C15ull) >> 32) & (map->capacity - 1);
+}
+
+// an address still in the map belongs to an object that died untraced
+static void map_put(object_map_t *map, uint64_t ptr, uint32_t id) {
+    size_t at = map_slot(map, ptr);
+    while (map->ptrs[at] != 0 && map->ptrs[at] != ptr)
+        at = (at + 1) & (map->capacity - 1);
+    if (map->ptrs[at] == 0)
+        map->count++;
+    map->ptrs[at] = ptr;
+    map->ids[at] = id;
+}
+
+// Removes ptr and returns its id, or 0 if no traced object lives there.
+static uint32_t map_remove(object_map_t *map, uint64_t ptr) {
+    if (ptr == 0)
+        return 0;
+    size_t mask = map->capacity - 1;
+    size_t at = map_slot(map, ptr);
+    while (map->ptrs[at] != ptr) {
+        if (map->ptrs[at] == 0)
+            return 0;
+        at = (at + 1) & mask;
+    }
+    uint32_t id = map->ids[at];
+    size_t hole = at;
+    for (size_t next = (hole + 1) & mask; map->ptrs[next] != 0; next = (next + 1) & mask) {
+        size_t home = map_slot(map, map->ptrs[next]);
+        // move the entry back if the hole lies between its home and it
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            map->ptrs[hole] = map->ptrs[next];
+            map->ids[hole] = map->ids[next];
+            hole = next;
+        }
+    }
+    map->ptrs[hole] = 0;
+    map->count--;
+    return id;
+}
+
+// Walks the merged events, naming each object by an id handed out in
+// allocation order from 1, and drops frees of objects the trace never saw
+// allocated. Returns 0 on success.
+static int assign_ids(trace_t *trace) {
+    object_map_t map;
+    map.capacity = 1024;
+    while (map.capacity < trace->count * 2)
+        map.capacity *= 2;
+    map.count = 0;
+    map.ptrs = calloc(map.capacity, sizeof(uint64_t));
+    map.ids = calloc(map.capacity, sizeof(uint32_t));
+    if (!map.ptrs || !map.ids) {
+        perror("calloc");
+        free(map.ptrs);
+        free(map.ids);
+        return -1;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < trace->count; i++) {
+        event_t e = trace->events[i];
+        switch (e.op) {
+        case TRACE_FREE:
+            e.id = map_remove(&map, e.ptr);
+            break;
+        case TRACE_REALLOC:
+            // resizing an untraced object starts a new one
+            e.id = map_remove(&map, e.old_ptr);
+            if (e.ptr) {
+                if (e.id == 0)
+                    e.id = ++trace->max_id;
+                map_put(&map, e.ptr, e.id);
+            }
+            break;
+        default:
+            e.id = ++trace->max_id;
+            map_put(&map, e.ptr, e.id);
+            break;
+        }
+        if (e.id != 0)
+            trace->events[kept++] = e;
+    }
+    trace->count = kept;
+    free(map.ptrs);
+    free(map.ids);
+    return 0;
+}
+
+// Maps the file and rebuilds the events in the order they happened.
+// Returns 0 on success.
+static int load_trace(const char *path, trace_t *trace) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(TraceFileHeader)) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t length = (size_t)st.st_size;
+    const char *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    const TraceFileHeader *header = (const TraceFileHeader *)data;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: not a trace, or from another version\n", path);
+        munmap((void *)data, length);
+        return -1;
+    }
+
+    // first pass: count the events and check every chunk fits the file
+    size_t count = 0;
+    size_t at = sizeof(TraceFileHeader);
+    while (at < length) {
+        const TraceChunkHeader *chunk = (const TraceChunkHeader *)(data + at);
+        if (length - at < sizeof(TraceChunkHeader) ||
+            (length - at - sizeof(TraceChunkHeader)) / sizeof(TraceRecord) < chunk->count) {
+            fprintf(stderr, "%s: truncated at byte %zu\n", path, at);
+            munmap((void *)data, length);
+            return -1;
+        }
+        count += chunk->count;
+        at += sizeof(TraceChunkHeader) + chunk->count * sizeof(TraceRecord);
+    }
+
+    trace->events = malloc((count ? count : 1) * sizeof(event_t));
+    if (!trace->events) {
+        perror("malloc");
+        munmap((void *)data, length);
+        return -1;
+    }
+    trace->count = count;
+    trace->max_id = 0;
+    trace->threads = 0;
+
+    // second pass: absolute times
+    size_t n = 0;
+    for (at = sizeof(TraceFileHeader); at < length;) {
+        const TraceChunkHeader *chunk = (const TraceChunkHeader *)(data + at);
+        const TraceRecord *records = (const TraceRecord *)(chunk + 1);
+        uint64_t time = chunk->base;
+        for (uint32_t i = 0; i < chunk->count; i++) {
+            time += records[i].delta;
+            event_t *e = &trace->events[n];
+            e->time = time;
+            e->ptr = records[i].ptr;
+            e->old_ptr = records[i].oldPtr;
+            e->size = (size_t)records[i].size;
+            e->seq = n++;
+            e->thread = chunk->thread;
+            e->id = 0;
+            e->op = records[i].op;
+            e->arg = records[i].arg;
+        }
+        if (chunk->thread + 1 > trace->threads)
+            trace->threads = chunk->thread + 1;
+        at += sizeof(TraceChunkHeader) + chunk->count * sizeof(TraceRecord);
+    }
+    munmap((void *)data, length);
+
+    qsort(trace->events, count, sizeof(event_t), compare_event);
+    if (assign_ids(trace) != 0) {
+        free(trace->events);
+        return -1;
+    }
+    return 0;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *replay_alloc(const allocator_t *a, const event_t *e) {
+    size_t alignment = (size_t)1 << e->arg;
+    void *ptr = NULL;
+    switch (e->op) {
+    case TRACE_MALLOC:
+        return a->tdmm ? t_malloc(e->size) : malloc(e->size);
+    case TRACE_CALLOC:
+        return a->tdmm ? t_calloc(1, e->size) : calloc(1, e->size);
+    case TRACE_ALIGNED:
+        if (a->tdmm)
+            return t_aligned_alloc(e->size, alignment);
+        if (posix_memalign(&ptr, alignment < sizeof(void *) ? sizeof(void *) : alignment, e->size))
+            return NULL;
+        return ptr;
+    }
+    return NULL;
+}
+
+static void replay_free(const allocator_t *a, void *ptr) {
+    if (a->tdmm)
+        t_free(ptr);
+    else
+        free(ptr);
+}
+
+// Runs the whole trace once and frees whatever it left live. Returns the
+// time in ns; failures counts allocations that returned NULL.
+static double replay(const allocator_t *a, const trace_t *trace, void **objects,
+                     size_t *failures) {
+    *failures = 0;
+    double t0 = now_ns();
+    for (size_t i = 0; i < trace->count; i++) {
+        const event_t *e = &trace->events[i];
+        char *ptr;
+        switch (e->op) {
+        case TRACE_FREE:
+            replay_free(a, objects[e->id]);
+            objects[e->id] = NULL;
+            continue;
+        case TRACE_REALLOC:
+            ptr = a->tdmm ? t_realloc(objects[e->id], e->size) : realloc(objects[e->id], e->size);
+            if (!ptr && e->size) {
+                (*failures)++;
+                continue;
+            }
+            break;
+        default:
+            ptr = replay_alloc(a, e);
+            if (!ptr) {
+                (*failures)++;
+                continue;
+            }
+            break;
+        }
+        if (ptr)
+            ptr[0] = (char)i;  // touch it, as the traced program did
+        objects[e->id] = ptr;
+    }
+    double elapsed = now_ns() - t0;
+
+    for (uint32_t id = 0; id <= trace->max_id; id++) {
+        if (objects[id]) {
+            replay_free(a, objects[id]);
+            objects[id] = NULL;
+        }
+    }
+    return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [all|glibc|first|best|worst|buddy|sequential|random|adaptive]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *filter = argc > 2 ? argv[2] : NULL;
+
+    trace_t trace;
+    if (load_trace(argv[1], &trace) != 0)
+        return EXIT_FAILURE;
+    void **objects = calloc((size_t)trace.max_id + 1, sizeof(void *));
+    if (!objects) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    double span = trace.count ? (trace.events[trace.count - 1].time - trace.events[0].time) / 1e6 : 0;
+    printf("%zu events, %u objects, %u threads, %.1f ms recorded\n",
+           trace.count, trace.max_id, trace.threads, span);
+    printf("%-11s %10s %10s %9s\n", "allocator", "ms", "Mops/s", "failures");
+
+    for (size_t i = 0; i < NUM_ALLOCATORS; i++) {
+        const allocator_t *a = &allocators[i];
+        if (filter && strcmp(filter, "all") != 0 && strcmp(filter, a->name) != 0)
+            continue;
+        if (a->tdmm)
+            t_init(a->strategy);
+
+        size_t failures;
+        double elapsed = replay(a, &trace, objects, &failures);
+        printf("%-11s %10.2f %10.2f %9zu\n", a->name, elapsed / 1e6,
+               elapsed > 0 ? trace.count / elapsed * 1e3 : 0.0, failures);
+        fflush(stdout);
+    }
+
+    free(objects);
+    free(trace.events);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include <string.h>
+#include "adaptive.h"
+
+// Heap growth is charged at roughly what faulting the new pages in costs,
+// 250 ns per 4 KiB page; a rise in fragmentation as growth of the free
+// bytes it cut off from the largest free block.
+#define GROWTH_NS_PER_BYTE (250.0 / 4096)
+#define COST_DECAY 0.75  // weight of the previous cost in the smoothed one
+
+static uint64_t decisionSequence = 0;
+
+void adaptInit(AdaptState* state) {
+    memset(state, 0, sizeof(*state));
+    for (unsigned cls = 0; cls < ADAPT_CLASSES; cls++) {
+        for (unsigned p = 0; p < ADAPT_POLICIES; p++)
+            state->classes[cls].cost[p] = -1;
+        state->classes[cls].freeRate = -1;
+    }
+}
+
+unsigned adaptClass(size_t size) {
+    unsigned cls = size ? 63 - (unsigned)__builtin_clzll((unsigned long long)size) : 0;
+    return cls < ADAPT_CLASSES ? cls : ADAPT_CLASSES - 1;
+}
+
+bool adaptTimed(const AdaptClass* c) {
+    return c->epochAllocs % ADAPT_SAMPLE == 0;
+}
+
+// Counts one allocation of the class. Returns true when it ends the epoch
+// and adaptDecide is due.
+bool adaptRecord(AdaptClass* c, bool timed, uint64_t ns, size_t grown) {
+    if (timed) {
+        c->samples++;
+        c->sampledNs += ns;
+    }
+    c->grownBytes += grown;
+    c->allocs++;
+    return ++c->epochAllocs >= ADAPT_EPOCH;
+}
+
+static void logSwitch(AdaptState* state, unsigned cls, const AdaptClass* c, unsigned to) {
+    AdaptDecision* d = &state->log[state->logged++ % ADAPT_LOG];
+    d->sequence = __atomic_add_fetch(&decisionSequence, 1, __ATOMIC_RELAXED);
+    d->sizeClass = (uint8_t)cls;
+    d->from = c->policy;
+    d->to = (uint8_t)to;
+    d->fromCost = c->cost[c->policy];
+    d->toCost = c->cost[to];
+}
+
+// Ends the class's epoch: charges the policy that ran, settles on the
+// cheapest policy if it is clearly cheaper, and picks the next epoch's
+// policy. Policies never run are tried first; after that every
+// ADAPT_EXPLORE-th epoch runs one of the other two, in turn, so their costs
+// follow the workload. A shift in the free rate settles on the policy that
+// just ran, the only one measured under the new pattern, and has the
+// others tried again.
+void adaptDecide(AdaptState* state, unsigned cls, double fragmentation, size_t freeBytes) {
+    AdaptClass* c = &state->classes[cls];
+    double allocs = c->epochAllocs;
+    double cost = (c->samples ? (double)c->sampledNs / c->samples : 0) +
+                  c->grownBytes * GROWTH_NS_PER_BYTE / allocs;
+    if (fragmentation > c->fragStart)
+        cost += (fragmentation - c->fragStart) * freeBytes * GROWTH_NS_PER_BYTE / allocs;
+
+    double freeRate = c->epochFrees / allocs;
+    double drift = freeRate > c->freeRate ? freeRate - c->freeRate : c->freeRate - freeRate;
+    bool shifted = c->freeRate >= 0 && drift > ADAPT_SHIFT;
+    c->freeRate = c->freeRate < 0 || shifted ? freeRate
+                                             : c->freeRate * COST_DECAY + freeRate * (1 - COST_DECAY);
+
+    double* smoothed = &c->cost[c->trial];
+    *smoothed = *smoothed < 0 || shifted ? cost : *smoothed * COST_DECAY + cost * (1 - COST_DECAY);
+    c->epochs++;
+
+    unsigned best = c->policy;
+    if (shifted) {
+        best = c->trial;
+    } else {
+        for (unsigned p = 0; p < ADAPT_POLICIES; p++) {
+            if (c->cost[p] >= 0 && c->cost[p] < c->cost[best])
+                best = p;
+        }
+    }
+    if (best != c->policy && (shifted || c->cost[best] < c->cost[c->policy] * (1 - ADAPT_MARGIN))) {
+        logSwitch(state, cls, c, best);
+        c->policy = (uint8_t)best;
+        c->switches++;
+    }
+    if (shifted) {
+        for (unsigned p = 0; p < ADAPT_POLICIES; p++) {
+            if (p != c->policy)
+                c->cost[p] = -1;
+        }
+    }
+
+    c->trial = c->policy;
+    for (unsigned p = 0; p < ADAPT_POLICIES; p++) {
+        if (c->cost[p] < 0) {
+            c->trial = (uint8_t)p;
+            break;
+        }
+    }
+    if (c->trial == c->policy && c->epochs % ADAPT_EXPLORE == 0)
+        c->trial = (uint8_t)((c->policy + 1 + (c->epochs / ADAPT_EXPLORE) % 2) % ADAPT_POLICIES);
+
+    c->epochAllocs = 0;
+    c->epochFrees = 0;
+    c->samples = 0;
+    c->sampledNs = 0;
+    c->grownBytes = 0;
+    c->fragStart = fragmentation;
+}
+
+// counts a freed heap block in the class its allocation was counted in
+void adaptFree(AdaptState* state, unsigned cls) {
+    AdaptClass* c = &state->classes[cls < ADAPT_CLASSES ? cls : ADAPT_CLASSES - 1];
+    c->frees++;
+    c->epochFrees++;
+}
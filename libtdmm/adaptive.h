@@ -0,0 +1,68 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Placement policy learning for the ADAPTIVE strategy. Each arena keeps one
+// AdaptState and every request size class in it runs its own policy: first,
+// best or worst fit, numbered as in alloc_strat_e. The class's allocations
+// are counted in epochs; at the end of each the policy that ran is charged
+// a cost per allocation, and the class moves to another policy only when
+// that one's cost is lower by more than ADAPT_MARGIN. Frees are counted
+// per class too: when an epoch's frees per allocation move more than
+// ADAPT_SHIFT away from the class's usual rate, the workload has changed
+// and the costs learned under the old pattern are dropped. Everything here
+// is guarded by the owning arena's lock.
+#define ADAPT_CLASSES 32           // floor(log2(size)), the last one open-ended
+#define ADAPT_POLICIES 3
+#define ADAPT_EPOCH 256            // allocations of a class between decisions
+#define ADAPT_SAMPLE 32            // one allocation in this many is timed
+#define ADAPT_EXPLORE 16           // every this many epochs a rival policy is tried
+#define ADAPT_MARGIN 0.10          // cost advantage needed to switch
+#define ADAPT_SHIFT 0.25           // change in frees per allocation that marks a new pattern
+#define ADAPT_LOG 32               // switches remembered per arena
+
+typedef struct AdaptClass {
+    uint8_t policy;               // the policy the class has settled on
+    uint8_t trial;                // the policy running this epoch
+    uint32_t epochAllocs;
+    uint32_t epochFrees;
+    uint32_t samples;             // timed allocations this epoch
+    uint64_t sampledNs;
+    size_t grownBytes;            // heap growth caused by this epoch's allocations
+    double fragStart;             // arena fragmentation when the epoch began
+    double cost[ADAPT_POLICIES];  // smoothed ns per allocation, < 0 if never run
+    double freeRate;              // smoothed frees per allocation, < 0 before the first epoch
+    size_t allocs;
+    size_t frees;
+    size_t epochs;
+    size_t switches;
+} AdaptClass;
+
+// one change of a class's settled policy
+typedef struct AdaptDecision {
+    uint64_t sequence;            // orders decisions across arenas
+    uint8_t sizeClass;
+    uint8_t from;
+    uint8_t to;
+    double fromCost;
+    double toCost;
+} AdaptDecision;
+
+typedef struct AdaptState {
+    AdaptClass classes[ADAPT_CLASSES];
+    AdaptDecision log[ADAPT_LOG]; // ring of the latest switches
+    size_t logged;                // switches ever logged
+} AdaptState;
+
+// Function declarations
+void adaptInit(AdaptState* state);
+unsigned adaptClass(size_t size);
+bool adaptTimed(const AdaptClass* c);
+bool adaptRecord(AdaptClass* c, bool timed, uint64_t ns, size_t grown);
+void adaptDecide(AdaptState* state, unsigned cls, double fragmentation, size_t freeBytes);
+void adaptFree(AdaptState* state, unsigned cls);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "tdmm.h"
+#include "doublell.h"
+#include "sizeclass.h"
+#include "sizetree.h"
+#include "buddy.h"
+#include "slab.h"
+#include "adaptive.h"
+#include "stats.h"
+
+#define MAX_ARENAS 256             // the arenas of every heap together
+#define MAX_HEAP_ARENAS 64         // arenas of one heap
+#define FREE_BINS 64               // log2 size bins, one per bit of size_t
+
+// One shard of the heap. Each arena owns its regions and free structures,
+// so threads assigned to different arenas never share a lock.
+typedef struct Arena {
+    pthread_mutex_t lock;
+    RegionList regions;        // heap regions mapped by this arena
+    FreeLists freeLists;       // free blocks only, bucketed by size class
+    SizeTree sizeTree;         // the same free blocks, ordered by size
+    BuddyHeap buddy;           // used instead of the above for BUDDY
+    SlabCache slabs;           // small objects, in front of every strategy
+    size_t nextRegionSize;     // size of the next region extendHeap maps
+    alloc_strat_e strategy;    // the strategy of the heap the arena belongs to
+    bool isolated;             // of a t_heap_create heap: no slabs or large mappings
+    SpaceStats stats;          // heap regions; space runs from header to end sentinel
+    size_t freeBins[FREE_BINS];  // indexed free blocks by floor(log2(size))
+    size_t freeBytes;          // their payload bytes
+    int sequentialCounter;     // for sequential allocation round robin
+    AdaptState adapt;          // per size class policies for ADAPTIVE
+    void* remoteFrees;         // lock-free stack of blocks freed by other arenas' threads
+    unsigned index;
+} Arena;
+
+#endif
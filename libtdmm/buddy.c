@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "buddy.h"
+#include "regiontable.h"
+#include "stats.h"
+
+#define BUDDY_PAGE 4096
+
+static void pushOrder(BuddyHeap* heap, BuddyBlock* block, int order) {
+    block->order = (uint8_t)order;
+    block->flags = BLOCK_FREE;
+    block->prev = NULL;
+    block->next = heap->freeOrders[order];
+    if (heap->freeOrders[order] != NULL)
+        heap->freeOrders[order]->prev = block;
+    heap->freeOrders[order] = block;
+    heap->orderBitmap |= 1ull << order;
+    heap->freeCounts[order]++;
+}
+
+static void removeOrder(BuddyHeap* heap, BuddyBlock* block) {
+    int order = block->order;
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        heap->freeOrders[order] = block->next;
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+    if (heap->freeOrders[order] == NULL)
+        heap->orderBitmap &= ~(1ull << order);
+    heap->freeCounts[order]--;
+    block->flags = 0;
+}
+
+// smallest order whose block holds size bytes plus the header
+static int orderFor(size_t size) {
+    size_t total = size + BUDDY_HEADER_SIZE;
+    if (total < size)
+        return -1;
+    int order = BUDDY_MIN_ORDER;
+    while (order <= BUDDY_MAX_ORDER && ((size_t)1 << order) < total)
+        order++;
+    return order <= BUDDY_MAX_ORDER ? order : -1;
+}
+
+// map a region holding one free block of the given order
+static bool addRegion(BuddyHeap* heap, int order) {
+    size_t mapSize = BUDDY_REGION_HEADER + ((size_t)1 << order);
+    statsCall(STAT_MMAP);
+    void* mem = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap in buddy addRegion failed");
+        return false;
+    }
+
+    if (!regionTableInsert(mem, mapSize, heap->arena, KIND_BUDDY)) {
+        statsCall(STAT_MUNMAP);
+        munmap(mem, mapSize);
+        return false;
+    }
+    statsMapped(mapSize);
+
+    BuddyRegion* region = (BuddyRegion*)mem;
+    region->base = (char*)mem + BUDDY_REGION_HEADER;
+    region->mapSize = mapSize;
+    region->order = order;
+    region->arena = heap->arena;
+    region->prev = NULL;
+    region->next = heap->regions;
+    if (heap->regions != NULL)
+        heap->regions->prev = region;
+    heap->regions = region;
+
+    BuddyBlock* block = (BuddyBlock*)region->base;
+    block->region = region;
+    block->arena = (uint16_t)heap->arena;
+    block->kind = KIND_BUDDY;
+    pushOrder(heap, block, order);
+    statAdd(&heap->stats.regions, 1);
+    statAdd(&heap->stats.space, (size_t)1 << order);
+    statAdd(&heap->stats.blocks, 1);
+    return true;
+}
+
+// unmaps a region whose whole space is one free block
+static void dropRegion(BuddyHeap* heap, BuddyRegion* region) {
+    removeOrder(heap, (BuddyBlock*)region->base);
+    if (region->prev != NULL)
+        region->prev->next = region->next;
+    else
+        heap->regions = region->next;
+    if (region->next != NULL)
+        region->next->prev = region->prev;
+    statSub(&heap->stats.regions, 1);
+    statSub(&heap->stats.space, (size_t)1 << region->order);
+    statSub(&heap->stats.blocks, 1);
+    regionTableRemove(region);
+    statsCall(STAT_MUNMAP);
+    statsUnmapped(region->mapSize);
+    if (munmap(region, region->mapSize) != 0)
+        perror("munmap in buddy dropRegion failed");
+}
+
+void buddyInit(BuddyHeap* heap, unsigned arena) {
+    // regions from an earlier t_init are abandoned, like the other strategies' heap
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        heap->freeOrders[i] = NULL;
+        heap->freeCounts[i] = 0;
+    }
+    heap->orderBitmap = 0;
+    heap->regions = NULL;
+    memset(&heap->stats, 0, sizeof(heap->stats));
+    heap->arena = arena;
+}
+
+// Unmaps every region of the heap, allocated blocks and all, and leaves it
+// empty. One munmap per region; no block is looked at.
+void buddyRelease(BuddyHeap* heap) {
+    BuddyRegion* region = heap->regions;
+    while (region != NULL) {
+        BuddyRegion* next = region->next;
+        regionTableRemove(region);
+        statsCall(STAT_MUNMAP);
+        statsUnmapped(region->mapSize);
+        if (munmap(region, region->mapSize) != 0)
+            perror("munmap in buddyRelease failed");
+        region = next;
+    }
+    buddyInit(heap, heap->arena);
+}
+
+void* buddyMalloc(BuddyHeap* heap, size_t size) {
+    int order = orderFor(size);
+    if (order < 0)
+        return NULL;
+
+    // smallest non-empty order that can hold the request
+    uint64_t candidates = heap->orderBitmap & (~0ull << order);
+    if (candidates == 0) {
+        int regionOrder = order > BUDDY_REGION_ORDER ? order : BUDDY_REGION_ORDER;
+        if (!addRegion(heap, regionOrder))
+            return NULL;
+        candidates = heap->orderBitmap & (~0ull << order);
+    }
+    int current = __builtin_ctzll(candidates);
+    BuddyBlock* block = heap->freeOrders[current];
+    removeOrder(heap, block);
+
+    // split down, returning the upper half to the free list at each level
+    while (current > order) {
+        current--;
+        BuddyBlock* half = (BuddyBlock*)((char*)block + ((size_t)1 << current));
+        half->region = block->region;
+        half->arena = block->arena;
+        half->kind = KIND_BUDDY;
+        pushOrder(heap, half, current);
+        statAdd(&heap->stats.blocks, 1);
+    }
+    block->order = (uint8_t)order;
+    block->flags = 0;
+    statAdd(&heap->stats.allocated, ((size_t)1 << order) - BUDDY_HEADER_SIZE);
+    return (char*)block + BUDDY_HEADER_SIZE;
+}
+
+void buddyFree(BuddyHeap* heap, void* ptr) {
+    if (!ptr) return;
+
+    BuddyBlock* block = (BuddyBlock*)((char*)ptr - BUDDY_HEADER_SIZE);
+    BuddyRegion* region = block->region;
+    int order = block->order;
+    statSub(&heap->stats.allocated, ((size_t)1 << order) - BUDDY_HEADER_SIZE);
+
+    // merge upward while the buddy is free and whole; the buddy of the block
+    // at offset off is the block at offset off ^ 2^order
+    while (order < region->order) {
+        size_t offset = (size_t)((char*)block - region->base);
+        BuddyBlock* buddy = (BuddyBlock*)(region->base + (offset ^ ((size_t)1 << order)));
+        if (!(buddy->flags & BLOCK_FREE) || buddy->order != order)
+            break;
+        removeOrder(heap, buddy);
+        statSub(&heap->stats.blocks, 1);
+        if (buddy < block)
+            block = buddy;
+        order++;
+    }
+    pushOrder(heap, block, order);
+
+    // a region that is free again goes back to the kernel, unless it is the
+    // heap's only one and would just be mapped again by the next request
+    if (order == region->order && (region->prev != NULL || region->next != NULL))
+        dropRegion(heap, region);
+}
+
+// Returns memory held by free blocks to the kernel: whole free regions are
+// unmapped, and the pages behind the header of other large free blocks are
+// released with madvise. The first *keep bytes found are left alone and
+// deducted from *keep. Returns the bytes released.
+size_t buddyTrim(BuddyHeap* heap, size_t* keep) {
+    size_t released = 0;
+    BuddyRegion* region = heap->regions;
+    while (region != NULL) {
+        BuddyRegion* next = region->next;
+        BuddyBlock* block = (BuddyBlock*)region->base;
+        if ((block->flags & BLOCK_FREE) && block->order == region->order) {
+            if (region->mapSize <= *keep) {
+                *keep -= region->mapSize;
+            } else {
+                released += region->mapSize;
+                dropRegion(heap, region);
+            }
+        }
+        region = next;
+    }
+
+    for (int order = BUDDY_TRIM_ORDER; order <= BUDDY_MAX_ORDER; order++) {
+        for (BuddyBlock* block = heap->freeOrders[order]; block != NULL; block = block->next) {
+            // whole pages past the header and the list links
+            uintptr_t start = ((uintptr_t)(block + 1) + BUDDY_PAGE - 1) & ~(uintptr_t)(BUDDY_PAGE - 1);
+            uintptr_t end = ((uintptr_t)block + ((size_t)1 << order)) & ~(uintptr_t)(BUDDY_PAGE - 1);
+            if (end <= start)
+                continue;
+            size_t span = end - start;
+            if (span <= *keep) {
+                *keep -= span;
+                continue;
+            }
+            statsCall(STAT_MADVISE);
+            madvise((void*)start, span, MADV_DONTNEED);
+            released += span;
+        }
+    }
+    return released;
+}
@@ -0,0 +1,60 @@
+#ifndef BUDDY_H
+#define BUDDY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "doublell.h"
+#include "stats.h"
+
+#define BUDDY_MIN_ORDER 5      // smallest block: 32 bytes including header
+#define BUDDY_REGION_ORDER 20  // default region: 1 MiB of buddy space
+#define BUDDY_MAX_ORDER 47
+#define BUDDY_TRIM_ORDER 14    // free blocks from 16 KiB up are worth an madvise
+
+// One mmap'd region managed as a single buddy tree of 2^order bytes
+typedef struct BuddyRegion {
+    char* base;                // start of the buddy space (offset 0)
+    size_t mapSize;            // bytes passed to mmap, descriptor included
+    int order;                 // the whole space is one block of this order
+    unsigned arena;            // arena that owns the region
+    struct BuddyRegion* prev;
+    struct BuddyRegion* next;
+} BuddyRegion;
+
+// Header in front of every buddy block; the free-list links are only
+// meaningful while the block is free and live in its payload. arena, flags
+// and kind sit at the same offsets as in Block, so either header can be
+// read through a Block* to find the owner and the kind.
+typedef struct BuddyBlock {
+    BuddyRegion* region;
+    uint16_t arena;
+    uint8_t flags;             // BLOCK_FREE while on a free list
+    uint8_t kind;              // always KIND_BUDDY
+    uint8_t order;
+    struct BuddyBlock* prev;
+    struct BuddyBlock* next;
+} BuddyBlock;
+
+#define BUDDY_HEADER_SIZE offsetof(BuddyBlock, prev)
+// the buddy space starts this far into a region so payloads stay aligned
+#define BUDDY_REGION_HEADER ((sizeof(BuddyRegion) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+// Per-order free lists and regions of one buddy heap
+typedef struct BuddyHeap {
+    BuddyBlock* freeOrders[BUDDY_MAX_ORDER + 1];
+    uint64_t orderBitmap;      // bit k set -> freeOrders[k] non-empty
+    size_t freeCounts[BUDDY_MAX_ORDER + 1];  // blocks on each free list
+    BuddyRegion* regions;
+    SpaceStats stats;          // space is the regions' buddy space, 2^order each
+    unsigned arena;            // stamped into every region this heap maps
+} BuddyHeap;
+
+// Function declarations
+void buddyInit(BuddyHeap* heap, unsigned arena);
+void buddyRelease(BuddyHeap* heap);
+void* buddyMalloc(BuddyHeap* heap, size_t size);
+void buddyFree(BuddyHeap* heap, void* ptr);
+size_t buddyTrim(BuddyHeap* heap, size_t* keep);
+
+#endif
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include "bump.h"
+#include "hugepage.h"
+#include "regiontable.h"
+
+// Maps a chunk with room for at least space bytes. Chunks are listed in the
+// region table so t_gcollect scans them for pointers into the heap.
+static BumpChunk* mapChunk(size_t space) {
+    if (space > SIZE_MAX / 2)
+        return NULL;
+    size_t size = regionMapSize(space + BUMP_CHUNK_HEADER);
+    if (size == 0)
+        return NULL;
+    bool huge;
+    BumpChunk* chunk = mapRegion(size, &huge);
+    if (chunk == NULL)
+        return NULL;
+    if (!regionTableInsert(chunk, size, 0, KIND_BUMP)) {
+        unmapRegion(chunk, size, huge);
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->huge = huge;
+    return chunk;
+}
+
+static char* chunkStart(BumpChunk* chunk) {
+    return (char*)chunk + BUMP_CHUNK_HEADER;
+}
+
+static char* chunkEnd(BumpChunk* chunk) {
+    return (char*)chunk + chunk->size;
+}
+
+static void useChunk(struct t_arena* arena, BumpChunk* chunk, char* top) {
+    arena->current = chunk;
+    arena->top = top;
+    arena->end = chunkEnd(chunk);
+}
+
+struct t_arena* bumpCreate(size_t chunkSize) {
+    if (chunkSize == 0)
+        chunkSize = BUMP_CHUNK_DEFAULT;
+    BumpChunk* chunk = mapChunk(chunkSize);
+    if (chunk == NULL)
+        return NULL;
+    struct t_arena* arena = (struct t_arena*)chunkStart(chunk);
+    arena->first = chunk;
+    arena->chunkSize = chunkSize;
+    useChunk(arena, chunk, chunkStart(chunk) + BUMP_ARENA_SIZE);
+    return arena;
+}
+
+// The current chunk is full: move on to the next chained chunk if the
+// request fits there, otherwise map a new one after the current chunk. A
+// chained chunk that is too small is left for later resets to reuse.
+void* bumpRefill(struct t_arena* arena, size_t size) {
+    BumpChunk* next = arena->current->next;
+    if (next == NULL || size > (size_t)(chunkEnd(next) - chunkStart(next))) {
+        BumpChunk* fresh = mapChunk(size > arena->chunkSize ? size : arena->chunkSize);
+        if (fresh == NULL)
+            return NULL;
+        fresh->next = next;
+        arena->current->next = fresh;
+        next = fresh;
+    }
+    useChunk(arena, next, chunkStart(next) + size);
+    return chunkStart(next);
+}
+
+// Rewinds to chunk and top as they were at a mark; a NULL chunk rewinds to
+// the start. Later chunks stay chained for reuse.
+void bumpReset(struct t_arena* arena, BumpChunk* chunk, char* top) {
+    if (chunk == NULL)
+        useChunk(arena, arena->first, chunkStart(arena->first) + BUMP_ARENA_SIZE);
+    else
+        useChunk(arena, chunk, top);
+}
+
+void bumpDestroy(struct t_arena* arena) {
+    BumpChunk* chunk = arena->first;  // the arena itself goes with this one
+    while (chunk != NULL) {
+        BumpChunk* next = chunk->next;
+        regionTableRemove(chunk);
+        if (unmapRegion(chunk, chunk->size, chunk->huge) != 0)
+            perror("munmap in bumpDestroy failed");
+        chunk = next;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef BUMP_H
+#define BUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "doublell.h"
+#include "tdmm.h"
+
+#define BUMP_CHUNK_DEFAULT ((size_t)64 * 1024)  // chunk size when none is asked for
+
+// One mapping of a bump arena. Objects are carved from the bytes after the
+// header, in order, and never freed one by one. Chunks stay chained after a
+// reset, so an arena that is reset per request stops mapping after warm-up.
+typedef struct BumpChunk {
+    struct BumpChunk* next;
+    size_t size;               // bytes mapped, header included
+    bool huge;
+} BumpChunk;
+
+#define BUMP_CHUNK_HEADER ((sizeof(BumpChunk) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+// The arena's descriptor lives at the start of its first chunk's space.
+struct t_arena {
+    char* top;                 // next free byte of the current chunk
+    char* end;                 // end of the current chunk
+    BumpChunk* current;
+    BumpChunk* first;
+    size_t chunkSize;          // size new chunks are mapped with, at least
+};
+
+#define BUMP_ARENA_SIZE ((sizeof(struct t_arena) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+// Function declarations
+struct t_arena* bumpCreate(size_t chunkSize);
+void* bumpRefill(struct t_arena* arena, size_t size);
+void bumpReset(struct t_arena* arena, BumpChunk* chunk, char* top);
+void bumpDestroy(struct t_arena* arena);
+
+// The whole allocation while the current chunk has room: round up, compare,
+// bump. size is at most SIZE_MAX / 2, so the rounding cannot wrap.
+static inline void* bumpAlloc(struct t_arena* arena, size_t size) {
+    size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    if (size <= (size_t)(arena->end - arena->top)) {
+        void* ptr = arena->top;
+        arena->top += size;
+        return ptr;
+    }
+    return bumpRefill(arena, size);
+}
+
+#endif
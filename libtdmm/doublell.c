@@ -2,108 +2,51 @@
 #include <stdlib.h>
 #include "doublell.h"
 
-Block* createBlock(size_t size) {
-    Block* newBlock = (Block*)malloc(sizeof(Block));
-    if (!newBlock) {
-        printf("Error: malloc failed!\n");
-        return NULL;
-    }
-
-    newBlock->size = size;
-    newBlock->free = true;
-    newBlock->prev = NULL;
-    newBlock->next = NULL;
-    return newBlock;
-}
-
-BlockList* createBlockList() {
-    BlockList* list = (BlockList*)malloc(sizeof(BlockList));
-    if (!list) {
-        printf("Error: malloc failed!\n");
-        return NULL;
-    }
-
+void initRegionList(RegionList* list) {
     list->head = NULL;
     list->tail = NULL;
     list->count = 0;
-    return list;
-}
-
-void insertBlockFront(BlockList* list, Block* block) {
-    block->next = list->head;
-    block->prev = NULL;
-
-    if (list->head != NULL)
-        list->head->prev = block;
-    else
-        list->tail = block;
-
-    list->head = block;
-    list->count++;
 }
 
-void insertBlockBack(BlockList* list, Block* block) {
-    block->next = NULL;
-    block->prev = list->tail;
+void insertRegionBack(RegionList* list, Region* region) {
+    region->next = NULL;
+    region->prev = list->tail;
 
     if (list->tail != NULL)
-        list->tail->next = block;
-    else
-        list->head = block;
-
-    list->tail = block;
-    list->count++;
-}
-
-void insertBlockAfter(BlockList* list, Block* target, Block* newBlock) {
-    if (!target) return;
-
-    newBlock->prev = target;
-    newBlock->next = target->next;
-
-    if (target->next != NULL)
-        target->next->prev = newBlock;
+        list->tail->next = region;
     else
-        list->tail = newBlock;
+        list->head = region;
 
-    target->next = newBlock;
+    list->tail = region;
     list->count++;
 }
 
-void removeBlock(BlockList* list, Block* block) {
-    if (!block) return;
+// unlinks the region; unmapping it is up to the caller
+void removeRegion(RegionList* list, Region* region) {
+    if (!region) return;
 
-    if (block->prev != NULL)
-        block->prev->next = block->next;
+    if (region->prev != NULL)
+        region->prev->next = region->next;
     else
-        list->head = block->next;
+        list->head = region->next;
 
-    if (block->next != NULL)
-        block->next->prev = block->prev;
+    if (region->next != NULL)
+        region->next->prev = region->prev;
     else
-        list->tail = block->prev;
+        list->tail = region->prev;
 
-    free(block);
+    region->prev = NULL;
+    region->next = NULL;
     list->count--;
 }
 
-// this is only for garbage collection but obviously we cannot use this cause it uses "free" -> don't think we have to implement garbage collection though
-// void destroyBlockList(BlockList* list) {
-//     Block* current = list->head;
-//     while (current != NULL) {
-//         Block* next = current->next;
-//         free(current);
-//         current = next;
-//     }
-//     free(list);
-// }
-
-void printBlockList(BlockList* list) {
-    Block* current = list->head;
+void printRegionList(RegionList* list) {
     int index = 0;
     printf("Block List:\n");
-    while (current != NULL) {
-        printf("  [%d] size=%zu, free=%s\n", index++, current->size, current->free ? "true" : "false");
-        current = current->next;
+    for (Region* region = list->head; region != NULL; region = region->next) {
+        for (Block* current = firstBlock(region); !isSentinel(current); current = nextBlock(current)) {
+            printf("  [%d] size=%zu, free=%s\n", index++, current->size,
+                   (current->flags & BLOCK_FREE) ? "true" : "false");
+        }
     }
 }
@@ -3,30 +3,108 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-// Define the structure of Block (Node)
+#define ALIGNMENT 16
+
+// Block flags
+#define BLOCK_FREE      0x01  // block is free and sits in the free structures
+#define BLOCK_PREV_FREE 0x02  // physical predecessor is free; its footer holds its size
+#define BLOCK_RED       0x04  // node colour in the size tree (free blocks only)
+#define BLOCK_ZEROED    0x08  // payload is still zero from mmap apart from the free links and footer
+#define BLOCK_TRIMMED   0x10  // free block whose interior pages were handed back with madvise
+
+// Which allocator a block header belongs to
+#define KIND_HEAP  0  // general heap block (first/best/worst fit)
+#define KIND_BUDDY 1  // buddy block, see buddy.h
+#define KIND_LARGE 2  // block with a mapping of its own, see large.h
+#define KIND_BUMP  3  // bump arena chunk (region table only), see bump.h
+
+// Header in front of every block (16 bytes). Allocated blocks carry nothing
+// else; a free block also has a footer holding its size in the last word of
+// its payload, so the block after it can find it in O(1).
 typedef struct Block {
-    size_t size;         // size of memory block
-    bool free;           // whether or not the block is free
-    struct Block* prev;  // previous block
-    struct Block* next;  // next block
+    size_t size;         // payload bytes, a multiple of ALIGNMENT
+    uint16_t arena;      // arena whose region holds the block
+    uint8_t flags;       // BLOCK_* bits
+    uint8_t kind;        // KIND_* value
+    union {
+        uint32_t regionOffset;  // sentinel or large block: distance back to the start of
+                                // its mapping, in ALIGNMENT units
+        uint32_t freeSlot;      // free heap block: its slot in its FreeIndex, see sizeclass.h
+        uint32_t adaptClass;    // allocated heap block under ADAPTIVE: the class its request counted in
+    };
 } Block;
 
-// Doubly linked list wrapper
-typedef struct BlockList {
-    Block* head;
-    Block* tail;
+// A free block keeps its list and tree links at the start of its payload
+typedef struct FreeBlock {
+    Block header;
+    struct FreeBlock* prevFree;  // previous block in the same size-class free list
+    struct FreeBlock* nextFree;  // next block in the same size-class free list
+    struct FreeBlock* left;      // size tree children and parent
+    struct FreeBlock* right;
+    struct FreeBlock* parent;
+} FreeBlock;
+
+// smallest payload that can hold the free links plus the footer
+#define MIN_PAYLOAD 48
+
+// Header at the start of every mmap'd heap region. Blocks follow it back to
+// back and the region ends with a zero-size allocated sentinel block, so
+// walking or coalescing never leaves the region.
+typedef struct Region {
+    size_t size;            // bytes mapped, this header included
+    struct Region* prev;    // previous region of the same arena
+    struct Region* next;    // next region of the same arena
+    uint32_t arena;
+    uint32_t huge;          // mapped through the huge-page path, see hugepage.h
+} Region;
+
+// Doubly linked list of regions
+typedef struct RegionList {
+    Region* head;
+    Region* tail;
     size_t count;
-} BlockList;
+} RegionList;
+
+static inline void* blockPayload(Block* block) {
+    return (char*)block + sizeof(Block);
+}
+
+static inline Block* payloadBlock(void* ptr) {
+    return (Block*)((char*)ptr - sizeof(Block));
+}
+
+static inline Block* nextBlock(Block* block) {
+    return (Block*)((char*)block + sizeof(Block) + block->size);
+}
+
+static inline size_t* blockFooter(Block* block) {
+    return (size_t*)((char*)block + sizeof(Block) + block->size - sizeof(size_t));
+}
+
+// only valid when block has BLOCK_PREV_FREE set
+static inline Block* prevBlock(Block* block) {
+    size_t prevSize = *((size_t*)block - 1);
+    return (Block*)((char*)block - prevSize - sizeof(Block));
+}
+
+static inline Block* firstBlock(Region* region) {
+    return (Block*)((char*)region + sizeof(Region));
+}
+
+static inline bool isSentinel(Block* block) {
+    return block->size == 0;
+}
+
+static inline Region* sentinelRegion(Block* sentinel) {
+    return (Region*)((char*)sentinel - (size_t)sentinel->regionOffset * ALIGNMENT);
+}
 
 // Function declarations
-BlockList* createBlockList();
-Block* createBlock(size_t size);
-void insertBlockFront(BlockList* list, Block* block);
-void insertBlockBack(BlockList* list, Block* block);
-void insertBlockAfter(BlockList* list, Block* target, Block* newBlock);
-void removeBlock(BlockList* list, Block* block);
-void destroyBlockList(BlockList* list);
-void printBlockList(BlockList* list);
-
-#endif
\ No newline at end of file
+void initRegionList(RegionList* list);
+void insertRegionBack(RegionList* list, Region* region);
+void removeRegion(RegionList* list, Region* region);
+void printRegionList(RegionList* list);
+
+#endif
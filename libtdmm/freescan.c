@@ -0,0 +1,101 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freescan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FREESCAN_X86 1
+#endif
+
+typedef size_t (*ScanFn)(const uint32_t* units, size_t count, uint32_t need);
+
+typedef struct ScanImpl {
+    const char* name;
+    ScanFn scan;
+} ScanImpl;
+
+static size_t scanScalar(const uint32_t* units, size_t count, uint32_t need) {
+    for (size_t i = 0; i < count; i++) {
+        if (units[i] >= need)
+            return i;
+    }
+    return count;
+}
+
+#ifdef FREESCAN_X86
+// SSE2 has only signed compares; flipping the sign bit of both sides makes
+// them order unsigned values. need is never 0, so need - 1 cannot wrap.
+__attribute__((target("sse2")))
+static size_t scanSse2(const uint32_t* units, size_t count, uint32_t need) {
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i below = _mm_xor_si128(_mm_set1_epi32((int)(need - 1)), bias);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(units + i)), bias);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, below)));
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + scanScalar(units + i, count - i, need);
+}
+
+// v >= need exactly where max(v, need) == v
+__attribute__((target("avx2")))
+static size_t scanAvx2(const uint32_t* units, size_t count, uint32_t need) {
+    const __m256i target = _mm256_set1_epi32((int)need);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(units + i));
+        __m256i fits = _mm256_cmpeq_epi32(_mm256_max_epu32(v, target), v);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(fits));
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + scanSse2(units + i, count - i, need);
+}
+#endif
+
+static const ScanImpl scalarImpl = { "scalar", scanScalar };
+#ifdef FREESCAN_X86
+static const ScanImpl sse2Impl = { "sse2", scanSse2 };
+static const ScanImpl avx2Impl = { "avx2", scanAvx2 };
+#endif
+
+static const ScanImpl* chosen = NULL;
+
+// The widest implementation the CPU runs, unless TDMM_SIMD names a
+// narrower one.
+static const ScanImpl* chooseImpl(void) {
+    const char* env = getenv("TDMM_SIMD");
+    if (env != NULL && strcmp(env, "scalar") == 0)
+        return &scalarImpl;
+#ifdef FREESCAN_X86
+    __builtin_cpu_init();
+    bool wantSse2 = env != NULL && strcmp(env, "sse2") == 0;
+    if (!wantSse2 && __builtin_cpu_supports("avx2"))
+        return &avx2Impl;
+    if (__builtin_cpu_supports("sse2"))
+        return &sse2Impl;
+#endif
+    return &scalarImpl;
+}
+
+// Threads racing on the first call all pick the same implementation.
+static const ScanImpl* impl(void) {
+    const ScanImpl* current = __atomic_load_n(&chosen, __ATOMIC_ACQUIRE);
+    if (current == NULL) {
+        current = chooseImpl();
+        __atomic_store_n(&chosen, current, __ATOMIC_RELEASE);
+    }
+    return current;
+}
+
+// Returns the index of the first of the count sizes that is at least need,
+// or count if none is.
+size_t freeScan(const uint32_t* units, size_t count, uint32_t need) {
+    return impl()->scan(units, count, need);
+}
+
+const char* freeScanName(void) {
+    return impl()->name;
+}
@@ -0,0 +1,16 @@
+#ifndef FREESCAN_H
+#define FREESCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorized search over packed free-block sizes. The implementation is
+// picked on first use from what the CPU supports: AVX2, SSE2, or a scalar
+// loop. TDMM_SIMD=scalar, sse2 or avx2 asks for a narrower one, e.g. to
+// compare them.
+
+// Function declarations
+size_t freeScan(const uint32_t* units, size_t count, uint32_t need);
+const char* freeScanName(void);
+
+#endif
@@ -0,0 +1,382 @@
+#define _GNU_SOURCE  // pthread_getattr_np, dl_iterate_phdr
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <link.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "gc.h"
+#include "doublell.h"
+#include "regiontable.h"
+#include "buddy.h"
+#include "bump.h"
+#include "slab.h"
+#include "stats.h"
+
+#define SLAB_MARK_WORDS ((SLAB_SIZE / ALIGNMENT + 63) / 64)  // bits for one slab's objects
+
+// One allocated block in the address-sorted index
+typedef struct GcEntry {
+    char* start;          // first payload byte
+    size_t size;          // payload bytes
+    size_t region;        // GcRegion the block lives in
+} GcEntry;
+
+// The mark bits of one mapping's blocks, bit i for its i-th entry
+typedef struct GcRegion {
+    size_t first;         // index of the region's first entry
+    uint64_t* marks;
+} GcRegion;
+
+// A marked block whose payload still has to be scanned
+typedef struct GcSpan {
+    char* start;
+    size_t size;
+} GcSpan;
+
+typedef struct GcState {
+    GcEntry* entries;     // allocated blocks outside the slabs, by address
+    size_t entryCount;
+    GcRegion* regions;
+    char* low;            // bounds of all indexed payloads, for a quick reject
+    char* high;
+    char* slabLimit;      // slabs in [slabBase, slabLimit) were handed out
+    uint64_t* slabLive;   // per slab: objects not on its free list
+    uint64_t* slabMarks;  // per slab: objects found reachable
+    GcSpan* stack;        // blocks marked but not scanned yet
+    size_t depth;
+    size_t stackCapacity;
+    unsigned arenaLimit;  // mappings of arenas from here on are roots, not collected
+} GcState;
+
+// The collector's tables are mapped directly; the heap is locked while it runs.
+static void* gcMap(size_t bytes) {
+    if (bytes == 0)
+        return NULL;
+    statsCall(STAT_MMAP);
+    void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap in gcMap failed");
+        return NULL;
+    }
+    return mem;
+}
+
+static void gcUnmap(void* mem, size_t bytes) {
+    if (mem != NULL) {
+        statsCall(STAT_MUNMAP);
+        munmap(mem, bytes);
+    }
+}
+
+static bool isLive(const uint64_t* bits, size_t bit) {
+    return bits[bit / 64] & (1ull << (bit % 64));
+}
+
+static void setBit(uint64_t* bits, size_t bit) {
+    bits[bit / 64] |= 1ull << (bit % 64);
+}
+
+// Counts the allocated blocks of the mapping and, once gc->entries is
+// mapped, records them there in address order. Slab objects are left to
+// indexSlabs().
+static size_t walkMapping(const RegionDesc* desc, GcState* gc, size_t region) {
+    size_t count = 0;
+    GcEntry* entries = gc->entries;
+    if (desc->arena >= gc->arenaLimit)
+        return 0;
+    if (desc->kind == KIND_HEAP) {
+        for (Block* block = firstBlock((Region*)desc->base); !isSentinel(block); block = nextBlock(block)) {
+            if (block->flags & BLOCK_FREE)
+                continue;
+            if (entries != NULL) {
+                entries[count].start = blockPayload(block);
+                entries[count].size = block->size;
+                entries[count].region = region;
+            }
+            count++;
+        }
+    } else if (desc->kind == KIND_BUDDY) {
+        BuddyRegion* buddyRegion = (BuddyRegion*)desc->base;
+        char* end = buddyRegion->base + ((size_t)1 << buddyRegion->order);
+        for (char* at = buddyRegion->base; at < end; at += (size_t)1 << ((BuddyBlock*)at)->order) {
+            BuddyBlock* block = (BuddyBlock*)at;
+            if (block->flags & BLOCK_FREE)
+                continue;
+            if (entries != NULL) {
+                entries[count].start = at + BUDDY_HEADER_SIZE;
+                entries[count].size = ((size_t)1 << block->order) - BUDDY_HEADER_SIZE;
+                entries[count].region = region;
+            }
+            count++;
+        }
+    } else if (desc->kind == KIND_LARGE) {
+        Block* block = (Block*)desc->base;
+        if (entries != NULL) {
+            entries[count].start = blockPayload(block);
+            entries[count].size = block->size;
+            entries[count].region = region;
+        }
+        count++;
+    }
+    return count;
+}
+
+static void pushSpan(GcState* gc, char* start, size_t size) {
+    if (gc->depth == gc->stackCapacity) {
+        size_t capacity = gc->stackCapacity ? gc->stackCapacity * 2 : SLAB_SIZE / sizeof(GcSpan);
+        GcSpan* stack = gcMap(capacity * sizeof(GcSpan));
+        if (stack == NULL) {
+            // out of memory for the mark stack: the block stays marked, so
+            // it survives; only blocks reachable solely through it may not
+            return;
+        }
+        if (gc->stack != NULL) {
+            memcpy(stack, gc->stack, gc->depth * sizeof(GcSpan));
+            gcUnmap(gc->stack, gc->stackCapacity * sizeof(GcSpan));
+        }
+        gc->stack = stack;
+        gc->stackCapacity = capacity;
+    }
+    gc->stack[gc->depth].start = start;
+    gc->stack[gc->depth].size = size;
+    gc->depth++;
+}
+
+static void markSlabObject(GcState* gc, char* ptr) {
+    Slab* slab = slabOf(ptr);
+    if (slab->capacity == 0 || slab->epoch != slabEpoch)
+        return;
+    char* first = (char*)slab + SLAB_HEADER_SIZE;
+    if (ptr < first)
+        return;
+    size_t index = (size_t)(ptr - first) / slab->objectSize;
+    if (index >= slab->capacity)
+        return;
+
+    size_t slabIndex = (size_t)((char*)slab - slabBase) / SLAB_SIZE;
+    uint64_t* live = gc->slabLive + slabIndex * SLAB_MARK_WORDS;
+    uint64_t* marks = gc->slabMarks + slabIndex * SLAB_MARK_WORDS;
+    if (!isLive(live, index) || isLive(marks, index))
+        return;
+    setBit(marks, index);
+    pushSpan(gc, first + index * slab->objectSize, slab->objectSize);
+}
+
+// Marks the block whose payload holds ptr, if there is one.
+static void markCandidate(GcState* gc, char* ptr) {
+    if (ptr >= slabBase && ptr < gc->slabLimit) {
+        markSlabObject(gc, ptr);
+        return;
+    }
+    if (ptr < gc->low || ptr >= gc->high)
+        return;
+
+    // last entry starting at or before ptr
+    size_t lo = 0, hi = gc->entryCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (gc->entries[mid].start <= ptr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return;
+    GcEntry* entry = &gc->entries[lo - 1];
+    if (ptr >= entry->start + entry->size)
+        return;
+
+    GcRegion* region = &gc->regions[entry->region];
+    size_t bit = lo - 1 - region->first;
+    if (isLive(region->marks, bit))
+        return;
+    setBit(region->marks, bit);
+    pushSpan(gc, entry->start, entry->size);
+}
+
+static void scanRange(GcState* gc, char* start, char* end) {
+    uintptr_t at = ((uintptr_t)start + sizeof(void*) - 1) & ~(uintptr_t)(sizeof(void*) - 1);
+    for (; at + sizeof(void*) <= (uintptr_t)end; at += sizeof(void*))
+        markCandidate(gc, *(char**)at);
+}
+
+static int scanSegments(struct dl_phdr_info* info, size_t size, void* data) {
+    (void)size;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_W))
+            continue;
+        char* start = (char*)(info->dlpi_addr + phdr->p_vaddr);
+        scanRange((GcState*)data, start, start + phdr->p_memsz);
+    }
+    return 0;
+}
+
+// Scans the calling thread's stack from this frame up, with the callee-saved
+// registers spilled into it first.
+static __attribute__((noinline)) void scanStack(GcState* gc) {
+    jmp_buf registers;
+    __builtin_unwind_init();
+    setjmp(registers);
+
+    pthread_attr_t attr;
+    void* stackLow;
+    size_t stackSize;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        perror("pthread_getattr_np in gc scanStack failed");
+        return;
+    }
+    pthread_attr_getstack(&attr, &stackLow, &stackSize);
+    pthread_attr_destroy(&attr);
+
+    char* top = (char*)stackLow + stackSize;
+    char* here = (char*)&registers;
+    scanRange(gc, here, top);
+}
+
+// The allocated blocks of mappings the collector leaves alone may still
+// point into the ones it collects, so they are scanned as roots. Bump
+// arena chunks are scanned whole, bytes past their top included.
+static void scanPinned(GcState* gc, const RegionDesc* descs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const RegionDesc* desc = &descs[i];
+        if (desc->kind == KIND_BUMP) {
+            scanRange(gc, desc->base + BUMP_CHUNK_HEADER, desc->base + desc->size);
+            continue;
+        }
+        if (desc->arena < gc->arenaLimit)
+            continue;
+        if (desc->kind == KIND_HEAP) {
+            for (Block* block = firstBlock((Region*)desc->base); !isSentinel(block); block = nextBlock(block)) {
+                if (!(block->flags & BLOCK_FREE))
+                    scanRange(gc, blockPayload(block), (char*)blockPayload(block) + block->size);
+            }
+        } else if (desc->kind == KIND_BUDDY) {
+            BuddyRegion* buddyRegion = (BuddyRegion*)desc->base;
+            char* end = buddyRegion->base + ((size_t)1 << buddyRegion->order);
+            for (char* at = buddyRegion->base; at < end; at += (size_t)1 << ((BuddyBlock*)at)->order) {
+                if (!(((BuddyBlock*)at)->flags & BLOCK_FREE))
+                    scanRange(gc, at + BUDDY_HEADER_SIZE, at + ((size_t)1 << ((BuddyBlock*)at)->order));
+            }
+        }
+    }
+}
+
+// Records which objects of each slab are allocated: all of them but the
+// ones on the slab's free list.
+static void indexSlabs(GcState* gc) {
+    size_t slabCount = (size_t)(gc->slabLimit - slabBase) / SLAB_SIZE;
+    for (size_t i = 0; i < slabCount; i++) {
+        Slab* slab = (Slab*)(slabBase + i * SLAB_SIZE);
+        if (slab->capacity == 0 || slab->epoch != slabEpoch)
+            continue;
+        uint64_t* live = gc->slabLive + i * SLAB_MARK_WORDS;
+        for (size_t bit = 0; bit < slab->capacity; bit++)
+            setBit(live, bit);
+        char* first = (char*)slab + SLAB_HEADER_SIZE;
+        for (char* object = slab->freeList; object != NULL; object = *(char**)object) {
+            size_t bit = (size_t)(object - first) / slab->objectSize;
+            live[bit / 64] &= ~(1ull << (bit % 64));
+        }
+    }
+}
+
+size_t gcCollect(void (*release)(void* ptr), unsigned arenaLimit) {
+    GcState gc;
+    memset(&gc, 0, sizeof(gc));
+    gc.arenaLimit = arenaLimit;
+    size_t freed = 0;
+
+    // index: one pass to size the tables, one to fill them. The region
+    // table is in address order and so is each region's walk, so the
+    // entries come out sorted.
+    size_t regionCount = regionTableCount();
+    RegionDesc* descs = gcMap(regionCount * sizeof(RegionDesc));
+    if (regionCount > 0 && descs == NULL)
+        return 0;
+    regionTableSnapshot(descs, regionCount);
+
+    size_t markWords = 0;
+    for (size_t i = 0; i < regionCount; i++) {
+        size_t count = walkMapping(&descs[i], &gc, i);
+        gc.entryCount += count;
+        markWords += (count + 63) / 64;
+    }
+    gc.slabLimit = slabBase ? slabLimit() : NULL;
+    size_t slabWords = slabBase ? (size_t)(gc.slabLimit - slabBase) / SLAB_SIZE * SLAB_MARK_WORDS : 0;
+
+    size_t entryBytes = gc.entryCount * sizeof(GcEntry);
+    size_t regionBytes = regionCount * sizeof(GcRegion);
+    size_t markBytes = markWords * sizeof(uint64_t);
+    size_t slabBytes = 2 * slabWords * sizeof(uint64_t);
+    gc.entries = gcMap(entryBytes);
+    gc.regions = gcMap(regionBytes);
+    uint64_t* markSpace = gcMap(markBytes);
+    uint64_t* slabSpace = gcMap(slabBytes);
+    if ((entryBytes && !gc.entries) || (regionBytes && !gc.regions) ||
+        (markBytes && !markSpace) || (slabBytes && !slabSpace))
+        goto done;
+
+    size_t filled = 0;
+    uint64_t* marks = markSpace;
+    for (size_t i = 0; i < regionCount; i++) {
+        GcEntry* base = gc.entries;
+        gc.entries = base + filled;
+        size_t count = walkMapping(&descs[i], &gc, i);
+        gc.entries = base;
+        gc.regions[i].first = filled;
+        gc.regions[i].marks = marks;
+        filled += count;
+        marks += (count + 63) / 64;
+    }
+    if (gc.entryCount > 0) {
+        GcEntry* last = &gc.entries[gc.entryCount - 1];
+        gc.low = gc.entries[0].start;
+        gc.high = last->start + last->size;
+    }
+    gc.slabLive = slabSpace;
+    gc.slabMarks = slabSpace + slabWords;
+    if (slabWords)
+        indexSlabs(&gc);
+
+    // mark: the roots first, then everything reachable from them
+    scanStack(&gc);
+    dl_iterate_phdr(scanSegments, &gc);
+    scanPinned(&gc, descs, regionCount);
+    while (gc.depth > 0) {
+        GcSpan span = gc.stack[--gc.depth];
+        scanRange(&gc, span.start, span.start + span.size);
+    }
+
+    // sweep, in address order
+    for (size_t i = 0; i < gc.entryCount; i++) {
+        GcRegion* region = &gc.regions[gc.entries[i].region];
+        if (!isLive(region->marks, i - region->first)) {
+            release(gc.entries[i].start);
+            freed++;
+        }
+    }
+    for (size_t i = 0; i < slabWords / SLAB_MARK_WORDS; i++) {
+        Slab* slab = (Slab*)(slabBase + i * SLAB_SIZE);
+        uint64_t* live = gc.slabLive + i * SLAB_MARK_WORDS;
+        uint64_t* slabMarks = gc.slabMarks + i * SLAB_MARK_WORDS;
+        char* first = (char*)slab + SLAB_HEADER_SIZE;
+        for (size_t bit = 0; bit < SLAB_MARK_WORDS * 64; bit++) {
+            if (isLive(live, bit) && !isLive(slabMarks, bit)) {
+                release(first + bit * slab->objectSize);
+                freed++;
+            }
+        }
+    }
+
+done:
+    gcUnmap(gc.stack, gc.stackCapacity * sizeof(GcSpan));
+    gcUnmap(slabSpace, slabBytes);
+    gcUnmap(markSpace, markBytes);
+    gcUnmap(gc.regions, regionBytes);
+    gcUnmap(gc.entries, entryBytes);
+    gcUnmap(descs, regionCount * sizeof(RegionDesc));
+    return freed;
+}
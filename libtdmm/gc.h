@@ -0,0 +1,22 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stddef.h>
+
+// Conservative mark-sweep over every block the allocator has handed out.
+// Any aligned word in the roots or in a reachable block that points into a
+// block's payload, interior pointers included, keeps that block alive.
+// Roots are the calling thread's stack and registers and the writable
+// segments of every loaded object; other threads' stacks and thread-local
+// storage are not scanned.
+//
+// The caller must hold every arena lock and have emptied the thread caches
+// and remote-free stacks, so that every block is either allocated or on a
+// free structure. Unreachable blocks are passed to release, in address
+// order, with the locks still held. Only mappings of arenas below
+// arenaLimit are collected; the allocated blocks of the others are roots.
+
+// Function declarations
+size_t gcCollect(void (*release)(void* ptr), unsigned arenaLimit);
+
+#endif
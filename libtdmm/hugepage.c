@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "hugepage.h"
+#include "stats.h"
+
+static bool hugeEnabled = false;
+static bool hugetlbFailed = false;  // MAP_HUGETLB refused once; stop asking
+static size_t hugeBytes = 0;        // bytes of live regions mapped or advised huge
+
+void hugePagesInit(void) {
+    const char* env = getenv("TDMM_HUGEPAGES");
+    hugePagesEnable(env != NULL && env[0] != '\0' && env[0] != '0');
+    // regions of an earlier t_init are abandoned, not unmapped
+    __atomic_store_n(&hugeBytes, 0, __ATOMIC_RELAXED);
+}
+
+void hugePagesEnable(bool enable) {
+    __atomic_store_n(&hugeEnabled, enable, __ATOMIC_RELAXED);
+}
+
+bool hugePagesEnabled(void) {
+    return __atomic_load_n(&hugeEnabled, __ATOMIC_RELAXED);
+}
+
+// the size a region of at least size bytes is actually mapped with
+size_t regionMapSize(size_t size) {
+    size_t granule = hugePagesEnabled() ? HUGE_PAGE_SIZE : BASE_PAGE_SIZE;
+    if (size > SIZE_MAX - granule)
+        return 0;
+    return (size + granule - 1) & ~(granule - 1);
+}
+
+// 2 MiB-aligned anonymous mapping: map one huge page extra and cut the
+// misaligned ends off
+static void* mapAligned(size_t size) {
+    statsCall(STAT_MMAP);
+    char* mem = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+    char* aligned = (char*)(((uintptr_t)mem + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > mem) {
+        statsCall(STAT_MUNMAP);
+        munmap(mem, (size_t)(aligned - mem));
+    }
+    size_t tail = (size_t)(mem + HUGE_PAGE_SIZE - aligned);
+    if (tail > 0) {
+        statsCall(STAT_MUNMAP);
+        munmap(aligned + size, tail);
+    }
+    return aligned;
+}
+
+// Maps a region of size bytes, a value from regionMapSize(). Sets *huge if
+// the region went to huge pages, so unmapRegion can keep the count right.
+// Returns NULL if the mapping fails.
+void* mapRegion(size_t size, bool* huge) {
+    *huge = false;
+    if (hugePagesEnabled() && size % HUGE_PAGE_SIZE == 0) {
+#ifdef MAP_HUGETLB
+        if (!__atomic_load_n(&hugetlbFailed, __ATOMIC_RELAXED)) {
+            statsCall(STAT_MMAP);
+            void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mem != MAP_FAILED) {
+                *huge = true;
+                __atomic_add_fetch(&hugeBytes, size, __ATOMIC_RELAXED);
+                statsMapped(size);
+                return mem;
+            }
+            __atomic_store_n(&hugetlbFailed, true, __ATOMIC_RELAXED);
+        }
+#endif
+        void* mem = mapAligned(size);
+        if (mem != NULL) {
+#ifdef MADV_HUGEPAGE
+            statsCall(STAT_MADVISE);
+            if (madvise(mem, size, MADV_HUGEPAGE) == 0) {
+                *huge = true;
+                __atomic_add_fetch(&hugeBytes, size, __ATOMIC_RELAXED);
+            }
+#endif
+            statsMapped(size);
+            return mem;
+        }
+        // no room for the extra alignment slack; a plain mapping still works
+    }
+
+    statsCall(STAT_MMAP);
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+    statsMapped(size);
+    return mem;
+}
+
+int unmapRegion(void* mem, size_t size, bool huge) {
+    if (huge)
+        __atomic_sub_fetch(&hugeBytes, size, __ATOMIC_RELAXED);
+    statsCall(STAT_MUNMAP);
+    statsUnmapped(size);
+    return munmap(mem, size);
+}
+
+// bytes of live regions on hugetlb pages or advised for transparent huge
+// pages; the kernel still decides whether the latter get them
+size_t hugePageBytes(void) {
+    return __atomic_load_n(&hugeBytes, __ATOMIC_RELAXED);
+}
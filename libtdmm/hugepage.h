@@ -0,0 +1,27 @@
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)  // x86-64 and arm64 default huge page
+#define BASE_PAGE_SIZE 4096
+
+// Heap regions are mapped through here. With huge pages turned on (by
+// TDMM_HUGEPAGES or t_set_huge_pages) region sizes are rounded up to
+// HUGE_PAGE_SIZE and each region is first requested from the hugetlb pool
+// with MAP_HUGETLB. If that fails, which it does whenever no huge pages are
+// reserved, the region is mapped 2 MiB-aligned and advised with
+// MADV_HUGEPAGE so transparent huge pages can back it; after the first
+// MAP_HUGETLB failure only the second route is tried.
+
+// Function declarations
+void hugePagesInit(void);
+void hugePagesEnable(bool enable);
+bool hugePagesEnabled(void);
+size_t regionMapSize(size_t size);
+void* mapRegion(size_t size, bool* huge);
+int unmapRegion(void* mem, size_t size, bool huge);
+size_t hugePageBytes(void);
+
+#endif
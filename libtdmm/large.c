@@ -0,0 +1,154 @@
+#define _GNU_SOURCE  // mremap
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "large.h"
+#include "regiontable.h"
+#include "stats.h"
+
+#define LARGE_PAGE 4096
+
+static size_t mmapThreshold = MMAP_THRESHOLD_DEFAULT;
+static bool thresholdFixed = false;  // set explicitly; stop adapting
+// every live large block, one mapping each, with space counted from the
+// header on; like the mapped bytes these outlive t_init, which leaves
+// earlier blocks mapped
+static SpaceStats largeSpace;
+
+// whole mapping length for a block whose header starts the mapping
+static size_t mappingLength(size_t size) {
+    return (size + sizeof(Block) + LARGE_PAGE - 1) & ~(size_t)(LARGE_PAGE - 1);
+}
+
+void largeInit(void) {
+    const char* env = getenv("TDMM_MMAP_THRESHOLD");
+    if (env) {
+        largeSetThreshold((size_t)strtoull(env, NULL, 10));
+        return;
+    }
+    __atomic_store_n(&mmapThreshold, MMAP_THRESHOLD_DEFAULT, __ATOMIC_RELAXED);
+    __atomic_store_n(&thresholdFixed, false, __ATOMIC_RELAXED);
+}
+
+void largeSetThreshold(size_t threshold) {
+    __atomic_store_n(&mmapThreshold, threshold, __ATOMIC_RELAXED);
+    __atomic_store_n(&thresholdFixed, true, __ATOMIC_RELAXED);
+}
+
+bool isLargeRequest(size_t size) {
+    return size >= __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED);
+}
+
+void* largeMalloc(size_t size, unsigned arena) {
+    return largeAlignedMalloc(size, ALIGNMENT, arena);
+}
+
+// start of the mapping that holds a large block
+static char* mappingStart(Block* block) {
+    return (char*)block - (size_t)block->regionOffset * ALIGNMENT;
+}
+
+// Maps a block whose payload is aligned to alignment (a power of two). Up
+// to a page the padding fits in the mapping's first page; beyond that the
+// mapping is over-sized by the alignment. The header records how far the
+// mapping starts before it.
+void* largeAlignedMalloc(size_t size, size_t alignment, unsigned arena) {
+    if (size > SIZE_MAX - sizeof(Block) - LARGE_PAGE - alignment)
+        return NULL;
+    size_t lead = alignment > sizeof(Block) ? alignment - sizeof(Block) : 0;
+    if (lead / ALIGNMENT > UINT32_MAX)
+        return NULL;
+    size_t length = mappingLength(size + lead);
+    statsCall(STAT_MMAP);
+    char* mem = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap in largeMalloc failed");
+        return NULL;
+    }
+
+    uintptr_t payload = ((uintptr_t)mem + sizeof(Block) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    Block* block = payloadBlock((void*)payload);
+    if (!regionTableInsert(block, (size_t)(mem + length - (char*)block), arena, KIND_LARGE)) {
+        statsCall(STAT_MUNMAP);
+        munmap(mem, length);
+        return NULL;
+    }
+    statsMapped(length);
+
+    // the usable size runs to the end of the mapping
+    block->size = (size_t)(mem + length - (char*)payload);
+    block->arena = (uint16_t)arena;
+    block->flags = 0;
+    block->kind = KIND_LARGE;
+    block->regionOffset = (uint32_t)(((char*)block - mem) / ALIGNMENT);
+    __atomic_add_fetch(&largeSpace.regions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&largeSpace.blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&largeSpace.space, sizeof(Block) + block->size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&largeSpace.allocated, block->size, __ATOMIC_RELAXED);
+    return (void*)payload;
+}
+
+void largeFree(void* ptr) {
+    Block* block = payloadBlock(ptr);
+    char* mem = mappingStart(block);
+    size_t length = (size_t)((char*)ptr - mem) + block->size;
+
+    if (!__atomic_load_n(&thresholdFixed, __ATOMIC_RELAXED)) {
+        size_t threshold = __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED);
+        if (block->size > threshold && block->size <= MMAP_THRESHOLD_MAX)
+            __atomic_store_n(&mmapThreshold, block->size, __ATOMIC_RELAXED);
+    }
+
+    regionTableRemove(block);
+    __atomic_sub_fetch(&largeSpace.regions, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&largeSpace.blocks, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&largeSpace.space, sizeof(Block) + block->size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&largeSpace.allocated, block->size, __ATOMIC_RELAXED);
+    statsCall(STAT_MUNMAP);
+    statsUnmapped(length);
+    if (munmap(mem, length) != 0)
+        perror("munmap in largeFree failed");
+}
+
+// Resizes the block's mapping with mremap, which may move it. The block
+// keeps its offset into the mapping, so alignment up to a page survives.
+// Returns NULL and leaves the block untouched if the kernel refuses.
+void* largeRealloc(void* ptr, size_t size) {
+    Block* block = payloadBlock(ptr);
+    char* mem = mappingStart(block);
+    size_t lead = (size_t)((char*)block - mem);
+    if (size > SIZE_MAX - sizeof(Block) - LARGE_PAGE - lead)
+        return NULL;
+    size_t oldLength = (size_t)((char*)ptr - mem) + block->size;
+    size_t newLength = mappingLength(size + lead);
+    if (newLength == oldLength)
+        return ptr;
+
+    statsCall(STAT_MREMAP);
+    char* newMem = mremap(mem, oldLength, newLength, MREMAP_MAYMOVE);
+    if (newMem == MAP_FAILED) {
+        perror("mremap in largeRealloc failed");
+        return NULL;
+    }
+    statsUnmapped(oldLength);
+    // the descriptor is updated in place: once mremap has moved the block
+    // there is no way back, so nothing after it may fail
+    regionTableMove(block, newMem + lead, newLength - lead);
+    block = (Block*)(newMem + lead);
+    __atomic_sub_fetch(&largeSpace.space, block->size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&largeSpace.allocated, block->size, __ATOMIC_RELAXED);
+    block->size = newLength - lead - sizeof(Block);
+    __atomic_add_fetch(&largeSpace.space, block->size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&largeSpace.allocated, block->size, __ATOMIC_RELAXED);
+    statsMapped(newLength);
+    return blockPayload(block);
+}
+
+// a snapshot of the live large blocks' counters
+void largeStats(SpaceStats* stats) {
+    stats->regions = __atomic_load_n(&largeSpace.regions, __ATOMIC_RELAXED);
+    stats->space = __atomic_load_n(&largeSpace.space, __ATOMIC_RELAXED);
+    stats->blocks = __atomic_load_n(&largeSpace.blocks, __ATOMIC_RELAXED);
+    stats->allocated = __atomic_load_n(&largeSpace.allocated, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,29 @@
+#ifndef LARGE_H
+#define LARGE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "doublell.h"
+#include "stats.h"
+
+#define MMAP_THRESHOLD_DEFAULT ((size_t)128 * 1024)
+#define MMAP_THRESHOLD_MAX ((size_t)32 * 1024 * 1024)
+
+// Requests at or above the threshold get an mmap of their own, headed by a
+// plain Block of kind KIND_LARGE, and are unmapped as soon as they are freed.
+// Until the threshold is set explicitly it adapts: freeing a mapped block
+// larger than the threshold raises the threshold to that size, so a
+// workload that keeps reallocating same-sized buffers stops paying an
+// mmap/munmap pair for each one.
+
+// Function declarations
+void largeInit(void);
+void largeSetThreshold(size_t threshold);
+bool isLargeRequest(size_t size);
+void* largeMalloc(size_t size, unsigned arena);
+void* largeAlignedMalloc(size_t size, size_t alignment, unsigned arena);
+void largeFree(void* ptr);
+void* largeRealloc(void* ptr, size_t size);
+void largeStats(SpaceStats* stats);
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include "tdmm.h"
+
+// LD_PRELOAD shim: the standard allocation functions on top of tdmm. It is
+// only built into libtdmm_preload.so, never into the static library. The
+// heap is set up by the first call, with the strategy named in
+// TDMM_STRATEGY (first, best, worst, buddy, sequential, random or adaptive;
+// first fit by default). Calls made on the initializing thread while t_init
+// runs, from libc or the dynamic loader, are served from a static buffer
+// whose memory is never reused.
+
+#define EXPORT __attribute__((visibility("default")))
+#define BOOTSTRAP_SIZE (64 * 1024)
+#define BOOTSTRAP_HEADER 16  // size of each bootstrap allocation, kept in front of it
+
+enum {
+    SHIM_UNINIT,
+    SHIM_INITIALIZING,
+    SHIM_READY
+};
+
+static int shimState = SHIM_UNINIT;
+static __thread bool initializing = false;
+static _Alignas(16) char bootstrap[BOOTSTRAP_SIZE];
+static size_t bootstrapUsed = 0;  // only the initializing thread touches it
+
+static alloc_strat_e envStrategy(void) {
+    const char* env = getenv("TDMM_STRATEGY");
+    if (env == NULL)
+        return FIRST_FIT;
+    if (strcmp(env, "best") == 0)
+        return BEST_FIT;
+    if (strcmp(env, "worst") == 0)
+        return WORST_FIT;
+    if (strcmp(env, "buddy") == 0)
+        return BUDDY;
+    if (strcmp(env, "sequential") == 0)
+        return SEQUENTIAL;
+    if (strcmp(env, "random") == 0)
+        return RANDOM;
+    if (strcmp(env, "adaptive") == 0)
+        return ADAPTIVE;
+    return FIRST_FIT;
+}
+
+// Returns false if the caller is the thread running t_init and must use
+// the bootstrap buffer. Other threads wait for t_init to finish.
+static bool ensureInit(void) {
+    if (__atomic_load_n(&shimState, __ATOMIC_ACQUIRE) == SHIM_READY)
+        return true;
+    if (initializing)
+        return false;
+    int expected = SHIM_UNINIT;
+    if (__atomic_compare_exchange_n(&shimState, &expected, SHIM_INITIALIZING, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        initializing = true;
+        t_init(envStrategy());
+        initializing = false;
+        __atomic_store_n(&shimState, SHIM_READY, __ATOMIC_RELEASE);
+        return true;
+    }
+    while (__atomic_load_n(&shimState, __ATOMIC_ACQUIRE) != SHIM_READY)
+        sched_yield();
+    return true;
+}
+
+static bool isBootstrap(const void* ptr) {
+    return (const char*)ptr >= bootstrap && (const char*)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+static void* bootstrapAlloc(size_t size, size_t alignment) {
+    if (alignment < BOOTSTRAP_HEADER)
+        alignment = BOOTSTRAP_HEADER;
+    uintptr_t base = (uintptr_t)bootstrap;
+    uintptr_t payload = (base + bootstrapUsed + BOOTSTRAP_HEADER + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (size > BOOTSTRAP_SIZE || payload + size > base + BOOTSTRAP_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *(size_t*)(payload - BOOTSTRAP_HEADER) = size;
+    bootstrapUsed = payload + size - base;
+    return (void*)payload;
+}
+
+static size_t bootstrapSize(const void* ptr) {
+    return *(const size_t*)((const char*)ptr - BOOTSTRAP_HEADER);
+}
+
+static void* failed(void* ptr) {
+    if (ptr == NULL)
+        errno = ENOMEM;
+    return ptr;
+}
+
+EXPORT void* malloc(size_t size) {
+    if (!ensureInit())
+        return bootstrapAlloc(size, 0);
+    return failed(t_malloc(size));
+}
+
+EXPORT void free(void* ptr) {
+    if (ptr == NULL || isBootstrap(ptr))
+        return;
+    t_free(ptr);
+}
+
+EXPORT void* calloc(size_t count, size_t size) {
+    if (!ensureInit()) {
+        if (size && count > SIZE_MAX / size) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        // the static buffer is zero and never reused
+        return bootstrapAlloc(count * size, 0);
+    }
+    return failed(t_calloc(count, size));
+}
+
+EXPORT void* realloc(void* ptr, size_t size) {
+    if (ptr != NULL && isBootstrap(ptr)) {
+        void* moved = malloc(size);
+        if (moved != NULL) {
+            size_t old = bootstrapSize(ptr);
+            memcpy(moved, ptr, old < size ? old : size);
+        }
+        return moved;
+    }
+    if (!ensureInit())
+        return bootstrapAlloc(size, 0);
+    void* moved = t_realloc(ptr, size);
+    return size == 0 ? moved : failed(moved);
+}
+
+EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (!ensureInit()) {
+        if (alignment < sizeof(void*) || (alignment & (alignment - 1)))
+            return EINVAL;
+        void* ptr = bootstrapAlloc(size, alignment);
+        if (ptr == NULL)
+            return ENOMEM;
+        *memptr = ptr;
+        return 0;
+    }
+    return t_posix_memalign(memptr, alignment, size);
+}
+
+EXPORT void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!ensureInit())
+        return bootstrapAlloc(size, alignment);
+    return failed(t_aligned_alloc(size, alignment));
+}
+
+EXPORT void* memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+EXPORT void* valloc(size_t size) {
+    return aligned_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void* pvalloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return aligned_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void* ptr) {
+    if (ptr != NULL && isBootstrap(ptr))
+        return bootstrapSize(ptr);
+    return t_usable_size(ptr);
+}
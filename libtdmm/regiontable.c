@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "regiontable.h"
+#include "stats.h"
+
+#define TABLE_INITIAL_CAPACITY 256
+
+static RegionTable table = { NULL, 0, 0 };
+static pthread_rwlock_t tableLock = PTHREAD_RWLOCK_INITIALIZER;
+
+// index of the first entry whose base is above addr
+static size_t upperBound(const void* addr) {
+    size_t lo = 0, hi = table.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((const char*)table.entries[mid].base <= (const char*)addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// the table lives in its own mapping, it cannot come from the heap it indexes
+static bool growTable(void) {
+    size_t capacity = table.capacity ? table.capacity * 2 : TABLE_INITIAL_CAPACITY;
+    statsCall(STAT_MMAP);
+    void* mem = mmap(NULL, capacity * sizeof(RegionDesc), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap in region table growTable failed");
+        return false;
+    }
+    if (table.entries != NULL) {
+        memcpy(mem, table.entries, table.count * sizeof(RegionDesc));
+        statsCall(STAT_MUNMAP);
+        munmap(table.entries, table.capacity * sizeof(RegionDesc));
+    }
+    table.entries = (RegionDesc*)mem;
+    table.capacity = capacity;
+    return true;
+}
+
+// forgets every mapping; t_init abandons the previous heap's regions
+void regionTableReset(void) {
+    pthread_rwlock_wrlock(&tableLock);
+    table.count = 0;
+    pthread_rwlock_unlock(&tableLock);
+}
+
+bool regionTableInsert(void* base, size_t size, unsigned arena, uint8_t kind) {
+    pthread_rwlock_wrlock(&tableLock);
+    if (table.count == table.capacity && !growTable()) {
+        pthread_rwlock_unlock(&tableLock);
+        return false;
+    }
+    size_t at = upperBound(base);
+    memmove(&table.entries[at + 1], &table.entries[at],
+            (table.count - at) * sizeof(RegionDesc));
+    table.entries[at].base = (char*)base;
+    table.entries[at].size = size;
+    table.entries[at].arena = (uint16_t)arena;
+    table.entries[at].kind = kind;
+    table.count++;
+    pthread_rwlock_unlock(&tableLock);
+    return true;
+}
+
+void regionTableRemove(void* base) {
+    pthread_rwlock_wrlock(&tableLock);
+    size_t at = upperBound(base);
+    if (at > 0 && table.entries[at - 1].base == (char*)base) {
+        memmove(&table.entries[at - 1], &table.entries[at],
+                (table.count - at) * sizeof(RegionDesc));
+        table.count--;
+    }
+    pthread_rwlock_unlock(&tableLock);
+}
+
+// Points the descriptor at base at a mapping that moved or changed size.
+// The entry count stays the same, so unlike an insert this cannot fail.
+void regionTableMove(void* oldBase, void* base, size_t size) {
+    pthread_rwlock_wrlock(&tableLock);
+    size_t at = upperBound(oldBase);
+    if (at > 0 && table.entries[at - 1].base == (char*)oldBase) {
+        RegionDesc entry = table.entries[at - 1];
+        memmove(&table.entries[at - 1], &table.entries[at],
+                (table.count - at) * sizeof(RegionDesc));
+        table.count--;
+        entry.base = (char*)base;
+        entry.size = size;
+        at = upperBound(base);
+        memmove(&table.entries[at + 1], &table.entries[at],
+                (table.count - at) * sizeof(RegionDesc));
+        table.entries[at] = entry;
+        table.count++;
+    }
+    pthread_rwlock_unlock(&tableLock);
+}
+
+size_t regionTableCount(void) {
+    pthread_rwlock_rdlock(&tableLock);
+    size_t count = table.count;
+    pthread_rwlock_unlock(&tableLock);
+    return count;
+}
+
+// Copies up to max descriptors in address order; returns how many there are.
+size_t regionTableSnapshot(RegionDesc* out, size_t max) {
+    pthread_rwlock_rdlock(&tableLock);
+    size_t count = table.count;
+    if (count > 0)
+        memcpy(out, table.entries, (count < max ? count : max) * sizeof(RegionDesc));
+    pthread_rwlock_unlock(&tableLock);
+    return count;
+}
+
+// held across fork() so the child never inherits it mid-update
+void regionTableLock(void) {
+    pthread_rwlock_wrlock(&tableLock);
+}
+
+void regionTableUnlock(void) {
+    pthread_rwlock_unlock(&tableLock);
+}
+
+// The child of a fork starts with a fresh lock instead: a rwlock only knows
+// it is write-locked by the thread id that took it, which the child lacks.
+void regionTableUnlockChild(void) {
+    pthread_rwlock_init(&tableLock, NULL);
+}
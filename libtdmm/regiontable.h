@@ -0,0 +1,39 @@
+#ifndef REGIONTABLE_H
+#define REGIONTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// One entry per mapping the allocator owns: heap regions, buddy regions
+// and directly mapped large blocks. The slab range is not listed; it is a
+// single reservation found through isSlabPointer().
+typedef struct RegionDesc {
+    char* base;           // first byte of the mapping
+    size_t size;          // bytes mapped
+    uint16_t arena;       // arena that owns the mapping
+    uint8_t kind;         // KIND_* of the blocks inside
+} RegionDesc;
+
+// Descriptors sorted by base address, so updates find their slot by binary
+// search and snapshots come out in address order. The table has a lock of
+// its own because regions of different arenas come and go under different
+// arena locks.
+typedef struct RegionTable {
+    RegionDesc* entries;
+    size_t count;
+    size_t capacity;
+} RegionTable;
+
+// Function declarations
+void regionTableReset(void);
+bool regionTableInsert(void* base, size_t size, unsigned arena, uint8_t kind);
+void regionTableRemove(void* base);
+void regionTableMove(void* oldBase, void* base, size_t size);
+size_t regionTableCount(void);
+size_t regionTableSnapshot(RegionDesc* out, size_t max);
+void regionTableLock(void);
+void regionTableUnlock(void);
+void regionTableUnlockChild(void);
+
+#endif
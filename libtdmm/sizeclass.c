@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "freescan.h"
+#include "sizeclass.h"
+#include "stats.h"
+
+#define INDEX_INITIAL_CAPACITY 256
+#define INDEX_ENTRY (sizeof(uint32_t) + sizeof(FreeBlock*))
+
+static int log2Floor(size_t x) {
+    return 63 - __builtin_clzll((unsigned long long)x);
+}
+
+// map a size to its (first level, second level) class
+static void mapSize(size_t size, int* fl, int* sl) {
+    if (size < SL_COUNT) {
+        // tiny sizes get one exact class each under fl = 0
+        *fl = 0;
+        *sl = (int)size;
+        return;
+    }
+    int f = log2Floor(size);
+    *fl = f;
+    *sl = (int)((size >> (f - SL_LOG2)) - SL_COUNT);
+}
+
+// Both arrays share one mapping, the sizes first so they start page aligned.
+static bool growIndex(FreeIndex* index) {
+    uint32_t capacity = index->capacity ? index->capacity * 2 : INDEX_INITIAL_CAPACITY;
+    if (capacity == 0 || capacity == INDEX_NONE)
+        return false;
+    statsCall(STAT_MMAP);
+    void* mem = mmap(NULL, (size_t)capacity * INDEX_ENTRY, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap in growIndex failed");
+        return false;
+    }
+    uint32_t* units = (uint32_t*)mem;
+    FreeBlock** blocks = (FreeBlock**)(units + capacity);
+    if (index->units != NULL) {
+        memcpy(units, index->units, index->count * sizeof(uint32_t));
+        memcpy(blocks, index->blocks, index->count * sizeof(FreeBlock*));
+        statsCall(STAT_MUNMAP);
+        munmap(index->units, (size_t)index->capacity * INDEX_ENTRY);
+    }
+    index->units = units;
+    index->blocks = blocks;
+    index->capacity = capacity;
+    return true;
+}
+
+// Moves the live entries to the front, so removal never has to touch a
+// block other than the one leaving.
+static void compactIndex(FreeIndex* index) {
+    uint32_t live = 0;
+    for (uint32_t slot = 0; slot < index->count; slot++) {
+        FreeBlock* block = index->blocks[slot];
+        if (block == NULL)
+            continue;
+        index->units[live] = index->units[slot];
+        index->blocks[live] = block;
+        block->header.freeSlot = live++;
+    }
+    index->count = live;
+}
+
+static void indexAdd(FreeIndex* index, FreeBlock* block) {
+    if (!index->active)
+        return;
+    if (!index->failed && index->count == index->capacity) {
+        if (index->live <= index->capacity / 2 && index->capacity != 0)
+            compactIndex(index);
+        else if (!growIndex(index))
+            index->failed = true;
+    }
+    if (index->failed) {
+        block->header.freeSlot = INDEX_NONE;
+        return;
+    }
+    index->units[index->count] = (uint32_t)(block->header.size / ALIGNMENT);
+    index->blocks[index->count] = block;
+    block->header.freeSlot = index->count++;
+    index->live++;
+}
+
+// Leaves a hole: a size of 0 never matches a search.
+static void indexRemove(FreeIndex* index, FreeBlock* block) {
+    uint32_t slot = block->header.freeSlot;
+    if (!index->active || slot == INDEX_NONE)
+        return;
+    index->units[slot] = 0;
+    index->blocks[slot] = NULL;
+    index->live--;
+    if (slot + 1 == index->count)
+        index->count--;
+}
+
+// A class is indexed from the first search that needs it on. Until then
+// pushing and popping its blocks costs nothing extra.
+static void activateIndex(FreeLists* lists, int fl) {
+    FreeIndex* index = &lists->index[fl];
+    index->active = true;
+    for (int sl = 0; sl < SL_COUNT; sl++) {
+        for (FreeBlock* current = lists->heads[fl][sl]; current != NULL; current = current->nextFree)
+            indexAdd(index, current);
+    }
+}
+
+void initFreeLists(FreeLists* lists) {
+    memset(lists, 0, sizeof(FreeLists));
+}
+
+// Unmaps the size indexes and empties the lists. Also safe on zeroed lists.
+void releaseFreeLists(FreeLists* lists) {
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+        FreeIndex* index = &lists->index[fl];
+        if (index->units != NULL) {
+            statsCall(STAT_MUNMAP);
+            munmap(index->units, (size_t)index->capacity * INDEX_ENTRY);
+        }
+    }
+    initFreeLists(lists);
+}
+
+void pushFreeBlock(FreeLists* lists, FreeBlock* block) {
+    int fl, sl;
+    mapSize(block->header.size, &fl, &sl);
+    indexAdd(&lists->index[fl], block);
+
+    FreeBlock* head = lists->heads[fl][sl];
+    block->prevFree = NULL;
+    block->nextFree = head;
+    if (head != NULL)
+        head->prevFree = block;
+    lists->heads[fl][sl] = block;
+
+    lists->slBitmap[fl] |= (uint8_t)(1u << sl);
+    lists->flBitmap |= 1ull << fl;
+    lists->count++;
+}
+
+void popFreeBlock(FreeLists* lists, FreeBlock* block) {
+    int fl, sl;
+    mapSize(block->header.size, &fl, &sl);
+    indexRemove(&lists->index[fl], block);
+
+    if (block->prevFree != NULL)
+        block->prevFree->nextFree = block->nextFree;
+    else
+        lists->heads[fl][sl] = block->nextFree;
+    if (block->nextFree != NULL)
+        block->nextFree->prevFree = block->prevFree;
+
+    if (lists->heads[fl][sl] == NULL) {
+        lists->slBitmap[fl] &= (uint8_t)~(1u << sl);
+        if (lists->slBitmap[fl] == 0) {
+            lists->flBitmap &= ~(1ull << fl);
+            // empty, so nothing is missing and every slot is a hole
+            lists->index[fl].count = 0;
+            lists->index[fl].live = 0;
+            lists->index[fl].failed = false;
+        }
+    }
+    block->prevFree = NULL;
+    block->nextFree = NULL;
+    lists->count--;
+}
+
+// Returns a free block of at least size bytes without unlinking it, or NULL.
+// The size is rounded up to the next class boundary first, so the head of
+// any non-empty class found through the bitmaps is guaranteed to fit.
+FreeBlock* findFreeBlock(FreeLists* lists, size_t size) {
+    size_t target = size;
+    if (size >= SL_COUNT) {
+        size_t round = ((size_t)1 << (log2Floor(size) - SL_LOG2)) - 1;
+        if (size + round < size)
+            return NULL;
+        target = size + round;
+    }
+
+    int fl, sl;
+    mapSize(target, &fl, &sl);
+    unsigned int slMap = lists->slBitmap[fl] & (~0u << sl);
+    if (slMap == 0 && fl + 1 < FL_COUNT) {
+        uint64_t flMap = lists->flBitmap & (~0ull << (fl + 1));
+        if (flMap != 0) {
+            fl = __builtin_ctzll(flMap);
+            slMap = lists->slBitmap[fl];
+        }
+    }
+    if (slMap != 0)
+        return lists->heads[fl][__builtin_ctz(slMap)];
+
+    // No class is guaranteed to fit, but the request's own class may still
+    // hold a block that is large enough. Every class above it is empty, so
+    // any block under its first-level class that fits is in it.
+    mapSize(size, &fl, &sl);
+    FreeIndex* index = &lists->index[fl];
+    if (!index->active)
+        activateIndex(lists, fl);
+    if (index->failed) {
+        for (FreeBlock* current = lists->heads[fl][sl]; current != NULL; current = current->nextFree) {
+            if (current->header.size >= size)
+                return current;
+        }
+        return NULL;
+    }
+    size_t need = size > ALIGNMENT ? (size + ALIGNMENT - 1) / ALIGNMENT : 1;
+    if (need > UINT32_MAX)
+        return NULL;
+    size_t at = freeScan(index->units, index->count, (uint32_t)need);
+    return at < index->count ? index->blocks[at] : NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef SIZECLASS_H
+#define SIZECLASS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "doublell.h"
+
+// Sizes are bucketed by power of two (first level) and then split into
+// SL_COUNT equal sub-classes (second level), so a class never spans more
+// than 1/SL_COUNT of its range.
+#define SL_LOG2 3
+#define SL_COUNT (1 << SL_LOG2)
+#define FL_COUNT 64
+
+// The sizes of the free blocks under one first-level class, packed in
+// ALIGNMENT units next to the blocks they describe, so a search for a block
+// of at least some size is a vector scan rather than a walk over list
+// links. A block's slot is kept in its header (freeSlot); removal leaves a
+// hole that is compacted away before the index grows. The arrays live in
+// their own mapping. If they cannot grow, the class is searched through its
+// lists until it empties.
+#define INDEX_NONE UINT32_MAX  // freeSlot of a block missing from its index
+
+typedef struct FreeIndex {
+    uint32_t* units;     // block sizes / ALIGNMENT
+    FreeBlock** blocks;
+    uint32_t count;      // slots in use, holes included
+    uint32_t capacity;
+    uint32_t live;       // slots holding a block
+    bool active;         // the class has been searched, so it is kept indexed
+    bool failed;         // some block of the class is missing from the index
+} FreeIndex;
+
+// Segregated free lists with two levels of bitmaps marking non-empty classes
+typedef struct FreeLists {
+    uint64_t flBitmap;                     // bit f set -> some class under f is non-empty
+    uint8_t slBitmap[FL_COUNT];            // bit s set -> heads[f][s] is non-empty
+    FreeBlock* heads[FL_COUNT][SL_COUNT];  // LIFO list of free blocks per class
+    size_t count;                          // number of free blocks in all classes
+    FreeIndex index[FL_COUNT];             // packed sizes per first-level class
+} FreeLists;
+
+// Function declarations
+void initFreeLists(FreeLists* lists);
+void releaseFreeLists(FreeLists* lists);
+void pushFreeBlock(FreeLists* lists, FreeBlock* block);
+void popFreeBlock(FreeLists* lists, FreeBlock* block);
+FreeBlock* findFreeBlock(FreeLists* lists, size_t size);
+
+#endif
@@ -0,0 +1,255 @@
+#include "sizetree.h"
+
+// order by size, then by address so equal sizes still have a total order
+static bool lessThan(FreeBlock* a, FreeBlock* b) {
+    if (a->header.size != b->header.size)
+        return a->header.size < b->header.size;
+    return a < b;
+}
+
+// the colour lives in the header flags so the payload only holds links
+static bool isRed(FreeBlock* node) {
+    return node != NULL && (node->header.flags & BLOCK_RED);
+}
+
+static void setRed(FreeBlock* node, bool red) {
+    if (red)
+        node->header.flags |= BLOCK_RED;
+    else
+        node->header.flags &= (uint8_t)~BLOCK_RED;
+}
+
+static void rotateLeft(SizeTree* tree, FreeBlock* x) {
+    FreeBlock* y = x->right;
+    x->right = y->left;
+    if (y->left != NULL)
+        y->left->parent = x;
+    y->parent = x->parent;
+    if (x->parent == NULL)
+        tree->root = y;
+    else if (x == x->parent->left)
+        x->parent->left = y;
+    else
+        x->parent->right = y;
+    y->left = x;
+    x->parent = y;
+}
+
+static void rotateRight(SizeTree* tree, FreeBlock* x) {
+    FreeBlock* y = x->left;
+    x->left = y->right;
+    if (y->right != NULL)
+        y->right->parent = x;
+    y->parent = x->parent;
+    if (x->parent == NULL)
+        tree->root = y;
+    else if (x == x->parent->right)
+        x->parent->right = y;
+    else
+        x->parent->left = y;
+    y->right = x;
+    x->parent = y;
+}
+
+// put v where u was in u's parent (v may be NULL)
+static void transplant(SizeTree* tree, FreeBlock* u, FreeBlock* v) {
+    if (u->parent == NULL)
+        tree->root = v;
+    else if (u == u->parent->left)
+        u->parent->left = v;
+    else
+        u->parent->right = v;
+    if (v != NULL)
+        v->parent = u->parent;
+}
+
+static FreeBlock* minimum(FreeBlock* node) {
+    while (node->left != NULL)
+        node = node->left;
+    return node;
+}
+
+void initSizeTree(SizeTree* tree) {
+    tree->root = NULL;
+    tree->count = 0;
+}
+
+void insertSizeTree(SizeTree* tree, FreeBlock* block) {
+    FreeBlock* parent = NULL;
+    FreeBlock** link = &tree->root;
+    while (*link != NULL) {
+        parent = *link;
+        link = lessThan(block, parent) ? &parent->left : &parent->right;
+    }
+    block->parent = parent;
+    block->left = NULL;
+    block->right = NULL;
+    setRed(block, true);
+    *link = block;
+    tree->count++;
+
+    // restore the red-black properties on the way back up
+    FreeBlock* node = block;
+    while (isRed(node->parent)) {
+        FreeBlock* p = node->parent;
+        FreeBlock* g = p->parent;
+        if (p == g->left) {
+            FreeBlock* uncle = g->right;
+            if (isRed(uncle)) {
+                setRed(p, false);
+                setRed(uncle, false);
+                setRed(g, true);
+                node = g;
+            } else {
+                if (node == p->right) {
+                    node = p;
+                    rotateLeft(tree, node);
+                    p = node->parent;
+                }
+                setRed(p, false);
+                setRed(g, true);
+                rotateRight(tree, g);
+            }
+        } else {
+            FreeBlock* uncle = g->left;
+            if (isRed(uncle)) {
+                setRed(p, false);
+                setRed(uncle, false);
+                setRed(g, true);
+                node = g;
+            } else {
+                if (node == p->left) {
+                    node = p;
+                    rotateRight(tree, node);
+                    p = node->parent;
+                }
+                setRed(p, false);
+                setRed(g, true);
+                rotateLeft(tree, g);
+            }
+        }
+    }
+    setRed(tree->root, false);
+}
+
+void removeSizeTree(SizeTree* tree, FreeBlock* block) {
+    FreeBlock* x;
+    FreeBlock* xParent;
+    bool removedRed = isRed(block);
+
+    if (block->left == NULL) {
+        x = block->right;
+        xParent = block->parent;
+        transplant(tree, block, block->right);
+    } else if (block->right == NULL) {
+        x = block->left;
+        xParent = block->parent;
+        transplant(tree, block, block->left);
+    } else {
+        // replace block with its in-order successor
+        FreeBlock* y = minimum(block->right);
+        removedRed = isRed(y);
+        x = y->right;
+        if (y->parent == block) {
+            xParent = y;
+        } else {
+            xParent = y->parent;
+            transplant(tree, y, y->right);
+            y->right = block->right;
+            y->right->parent = y;
+        }
+        transplant(tree, block, y);
+        y->left = block->left;
+        y->left->parent = y;
+        setRed(y, isRed(block));
+    }
+    tree->count--;
+    block->left = NULL;
+    block->right = NULL;
+    block->parent = NULL;
+
+    if (removedRed)
+        return;
+
+    // a black node was removed: push the missing black up or rebalance
+    while (x != tree->root && !isRed(x)) {
+        if (x == xParent->left) {
+            FreeBlock* w = xParent->right;
+            if (isRed(w)) {
+                setRed(w, false);
+                setRed(xParent, true);
+                rotateLeft(tree, xParent);
+                w = xParent->right;
+            }
+            if (!isRed(w->left) && !isRed(w->right)) {
+                setRed(w, true);
+                x = xParent;
+                xParent = x->parent;
+            } else {
+                if (!isRed(w->right)) {
+                    setRed(w->left, false);
+                    setRed(w, true);
+                    rotateRight(tree, w);
+                    w = xParent->right;
+                }
+                setRed(w, isRed(xParent));
+                setRed(xParent, false);
+                setRed(w->right, false);
+                rotateLeft(tree, xParent);
+                x = tree->root;
+            }
+        } else {
+            FreeBlock* w = xParent->left;
+            if (isRed(w)) {
+                setRed(w, false);
+                setRed(xParent, true);
+                rotateRight(tree, xParent);
+                w = xParent->left;
+            }
+            if (!isRed(w->left) && !isRed(w->right)) {
+                setRed(w, true);
+                x = xParent;
+                xParent = x->parent;
+            } else {
+                if (!isRed(w->left)) {
+                    setRed(w->right, false);
+                    setRed(w, true);
+                    rotateLeft(tree, w);
+                    w = xParent->left;
+                }
+                setRed(w, isRed(xParent));
+                setRed(xParent, false);
+                setRed(w->left, false);
+                rotateRight(tree, xParent);
+                x = tree->root;
+            }
+        }
+    }
+    if (x != NULL)
+        setRed(x, false);
+}
+
+// smallest free block with at least size bytes (lowest address on ties)
+FreeBlock* lowerBoundSizeTree(SizeTree* tree, size_t size) {
+    FreeBlock* best = NULL;
+    FreeBlock* node = tree->root;
+    while (node != NULL) {
+        if (node->header.size >= size) {
+            best = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return best;
+}
+
+// largest free block
+FreeBlock* maxSizeTree(SizeTree* tree) {
+    FreeBlock* node = tree->root;
+    if (node == NULL)
+        return NULL;
+    while (node->right != NULL)
+        node = node->right;
+    return node;
+}
@@ -0,0 +1,20 @@
+#ifndef SIZETREE_H
+#define SIZETREE_H
+
+#include <stddef.h>
+#include "doublell.h"
+
+// Red-black tree of free blocks ordered by (size, address)
+typedef struct SizeTree {
+    FreeBlock* root;
+    size_t count;
+} SizeTree;
+
+// Function declarations
+void initSizeTree(SizeTree* tree);
+void insertSizeTree(SizeTree* tree, FreeBlock* block);
+void removeSizeTree(SizeTree* tree, FreeBlock* block);
+FreeBlock* lowerBoundSizeTree(SizeTree* tree, size_t size);
+FreeBlock* maxSizeTree(SizeTree* tree);
+
+#endif
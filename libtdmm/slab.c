@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "slab.h"
+#include "stats.h"
+
+char* slabBase = NULL;
+char* slabEnd = NULL;
+uint8_t slabEpoch = 0;
+
+// Slab pages are carved from one reserved range. It starts out PROT_NONE
+// and is made accessible in SLAB_COMMIT_CHUNK steps as the bump pointer
+// advances. Empty slabs go to a shared pool instead of back to the kernel;
+// slabTrim() releases the pool's pages, after which the slabs can no longer
+// hold their own links and are tracked in a separate array instead.
+static pthread_mutex_t spaceLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t spaceOnce = PTHREAD_ONCE_INIT;
+static char* slabBump = NULL;       // next slab never handed out
+static char* slabCommitted = NULL;  // end of the accessible part
+static Slab* emptySlabs = NULL;     // pool shared by all arenas
+static Slab** releasedSlabs = NULL; // empty slabs whose pages were released
+static size_t releasedCount = 0;
+static size_t releasedCapacity = 0;
+
+static void reserveSpace(void) {
+    statsCall(STAT_MMAP);
+    void* mem = mmap(NULL, SLAB_RESERVE, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        // no slab layer: small requests fall through to the strategies
+        return;
+    }
+    // slabOf() masks pointers, so slabs must start on SLAB_SIZE boundaries
+    slabBase = (char*)mem;
+    slabBump = slabBase;
+    slabCommitted = slabBase;
+    slabEnd = slabBase + SLAB_RESERVE;
+}
+
+static Slab* takeSlab(void) {
+    Slab* slab = NULL;
+    pthread_mutex_lock(&spaceLock);
+    if (emptySlabs != NULL) {
+        slab = emptySlabs;
+        emptySlabs = slab->next;
+    } else if (releasedCount > 0) {
+        slab = releasedSlabs[--releasedCount];
+    } else if (slabBump < slabEnd) {
+        if (slabBump == slabCommitted) {
+            statsCall(STAT_MPROTECT);
+            if (mprotect(slabCommitted, SLAB_COMMIT_CHUNK, PROT_READ | PROT_WRITE) != 0) {
+                perror("mprotect in slab takeSlab failed");
+                pthread_mutex_unlock(&spaceLock);
+                return NULL;
+            }
+            // the reserve is only counted as mapped once it is usable
+            statsMapped(SLAB_COMMIT_CHUNK);
+            slabCommitted += SLAB_COMMIT_CHUNK;
+        }
+        slab = (Slab*)slabBump;
+        slabBump += SLAB_SIZE;
+    }
+    pthread_mutex_unlock(&spaceLock);
+    return slab;
+}
+
+static void releaseSlab(Slab* slab) {
+    pthread_mutex_lock(&spaceLock);
+    slab->next = emptySlabs;
+    emptySlabs = slab;
+    pthread_mutex_unlock(&spaceLock);
+}
+
+// makes room for one more released slab; caller holds spaceLock
+static bool growReleased(void) {
+    if (releasedCount < releasedCapacity)
+        return true;
+    size_t capacity = releasedCapacity ? releasedCapacity * 2 : SLAB_SIZE / sizeof(Slab*);
+    statsCall(STAT_MMAP);
+    void* mem = mmap(NULL, capacity * sizeof(Slab*), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return false;
+    if (releasedSlabs != NULL) {
+        memcpy(mem, releasedSlabs, releasedCount * sizeof(Slab*));
+        statsCall(STAT_MUNMAP);
+        munmap(releasedSlabs, releasedCapacity * sizeof(Slab*));
+    }
+    releasedSlabs = (Slab**)mem;
+    releasedCapacity = capacity;
+    return true;
+}
+
+// Hands the pages of pooled empty slabs back to the kernel, leaving the
+// first *keep bytes' worth alone and deducting them from *keep. Returns
+// the bytes released.
+size_t slabTrim(size_t* keep) {
+    size_t released = 0;
+    pthread_mutex_lock(&spaceLock);
+    Slab** link = &emptySlabs;
+    while (*link != NULL) {
+        Slab* slab = *link;
+        if (SLAB_SIZE <= *keep) {
+            *keep -= SLAB_SIZE;
+            link = &slab->next;
+            continue;
+        }
+        if (!growReleased())
+            break;
+        *link = slab->next;
+        statsCall(STAT_MADVISE);
+        madvise(slab, SLAB_SIZE, MADV_DONTNEED);
+        releasedSlabs[releasedCount++] = slab;
+        released += SLAB_SIZE;
+    }
+    pthread_mutex_unlock(&spaceLock);
+    return released;
+}
+
+static void linkPartial(SlabCache* cache, Slab* slab) {
+    Slab* head = cache->partial[slab->sizeClass];
+    slab->prev = NULL;
+    slab->next = head;
+    if (head != NULL)
+        head->prev = slab;
+    cache->partial[slab->sizeClass] = slab;
+    slab->partial = true;
+}
+
+static void unlinkPartial(SlabCache* cache, Slab* slab) {
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        cache->partial[slab->sizeClass] = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+    slab->prev = NULL;
+    slab->next = NULL;
+    slab->partial = false;
+}
+
+// lays out a fresh slab for the class, all objects on its free list
+static Slab* newSlab(SlabCache* cache, int sizeClass) {
+    Slab* slab = takeSlab();
+    if (slab == NULL)
+        return NULL;
+
+    size_t objectSize = (size_t)(sizeClass + 1) * ALIGNMENT;
+    slab->objectSize = (uint16_t)objectSize;
+    slab->capacity = (uint16_t)((SLAB_SIZE - SLAB_HEADER_SIZE) / objectSize);
+    slab->freeCount = slab->capacity;
+    slab->arena = (uint16_t)cache->arena;
+    slab->sizeClass = (uint8_t)sizeClass;
+    slab->epoch = slabEpoch;
+
+    // thread the objects in address order so early allocations stay dense
+    char* first = (char*)slab + SLAB_HEADER_SIZE;
+    for (uint16_t i = 0; i + 1 < slab->capacity; i++)
+        *(void**)(first + i * objectSize) = first + (i + 1) * objectSize;
+    *(void**)(first + (slab->capacity - 1) * objectSize) = NULL;
+    slab->freeList = first;
+
+    statAdd(&cache->stats.regions, 1);
+    statAdd(&cache->stats.space, slab->capacity * objectSize);
+    statAdd(&cache->stats.blocks, slab->capacity);
+    linkPartial(cache, slab);
+    return slab;
+}
+
+// called by t_init before the arenas' caches are set up again
+void slabNewEpoch(void) {
+    slabEpoch++;
+}
+
+// end of the slabs handed out so far; everything past it was never used
+char* slabLimit(void) {
+    pthread_mutex_lock(&spaceLock);
+    char* limit = slabBump;
+    pthread_mutex_unlock(&spaceLock);
+    return limit;
+}
+
+void slabCacheInit(SlabCache* cache, unsigned arena) {
+    pthread_once(&spaceOnce, reserveSpace);
+    // slabs from an earlier t_init are abandoned, like the strategies' regions
+    for (int i = 0; i < SLAB_CLASSES; i++)
+        cache->partial[i] = NULL;
+    memset(&cache->stats, 0, sizeof(cache->stats));
+    cache->arena = arena;
+}
+
+// Returns an object of at least size bytes, or NULL if size is too large or
+// the slab space is unavailable. Caller holds the arena's lock.
+void* slabMalloc(SlabCache* cache, size_t size) {
+    if (size > SLAB_MAX_SIZE || slabBase == NULL)
+        return NULL;
+    int sizeClass = size == 0 ? 0 : (int)((size + ALIGNMENT - 1) / ALIGNMENT) - 1;
+
+    Slab* slab = cache->partial[sizeClass];
+    if (slab == NULL) {
+        slab = newSlab(cache, sizeClass);
+        if (slab == NULL)
+            return NULL;
+    }
+
+    void* object = slab->freeList;
+    slab->freeList = *(void**)object;
+    slab->freeCount--;
+    if (slab->freeCount == 0)
+        unlinkPartial(cache, slab);
+    statAdd(&cache->stats.allocated, slab->objectSize);
+    return object;
+}
+
+// Caller holds the lock of the arena that owns the slab.
+void slabFree(SlabCache* cache, void* ptr) {
+    Slab* slab = slabOf(ptr);
+    *(void**)ptr = slab->freeList;
+    slab->freeList = ptr;
+    slab->freeCount++;
+    statSub(&cache->stats.allocated, slab->objectSize);
+
+    if (!slab->partial) {
+        // the slab was full; it can serve allocations again
+        linkPartial(cache, slab);
+    } else if (slab->freeCount == slab->capacity &&
+               (slab->prev != NULL || slab->next != NULL)) {
+        // empty and not the class's last partial slab: share it
+        unlinkPartial(cache, slab);
+        statSub(&cache->stats.regions, 1);
+        statSub(&cache->stats.space, (size_t)slab->capacity * slab->objectSize);
+        statSub(&cache->stats.blocks, slab->capacity);
+        releaseSlab(slab);
+    }
+}
+
+// held across fork() so the child never inherits it mid-update
+void slabLockSpace(void) {
+    pthread_mutex_lock(&spaceLock);
+}
+
+void slabUnlockSpace(void) {
+    pthread_mutex_unlock(&spaceLock);
+}
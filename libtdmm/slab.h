@@ -0,0 +1,65 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "doublell.h"
+#include "stats.h"
+
+#define SLAB_SIZE 4096                              // one page per slab
+#define SLAB_MAX_SIZE 256                           // larger requests skip the slab layer
+#define SLAB_CLASSES (SLAB_MAX_SIZE / ALIGNMENT)    // 16, 32, ... 256 bytes
+#define SLAB_RESERVE ((size_t)16 << 30)             // address space reserved for slabs
+#define SLAB_COMMIT_CHUNK ((size_t)1 << 20)         // made accessible this much at a time
+
+// Header at the start of every slab page. Objects follow it back to back
+// and carry no header of their own; a free object holds the link to the
+// next free object of its slab in its first word.
+typedef struct Slab {
+    void* freeList;       // free objects of this slab
+    struct Slab* prev;    // partial slabs of the same class
+    struct Slab* next;
+    uint16_t objectSize;
+    uint16_t capacity;    // objects per slab
+    uint16_t freeCount;
+    uint16_t arena;       // arena whose lock guards this slab
+    uint8_t sizeClass;
+    bool partial;         // linked into its class's partial list
+    uint8_t epoch;        // slabEpoch when the slab was laid out
+} Slab;
+
+#define SLAB_HEADER_SIZE ((sizeof(Slab) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+// Per-arena slabs that still have free objects, by size class
+typedef struct SlabCache {
+    Slab* partial[SLAB_CLASSES];
+    SpaceStats stats;     // slabs the cache holds, partial or full, and their objects
+    unsigned arena;
+} SlabCache;
+
+// every slab lives in [slabBase, slabEnd), which is reserved once
+extern char* slabBase;
+extern char* slabEnd;
+// bumped by slabNewEpoch(); slabs laid out before belong to an abandoned heap
+extern uint8_t slabEpoch;
+
+static inline bool isSlabPointer(void* ptr) {
+    return (char*)ptr >= slabBase && (char*)ptr < slabEnd;
+}
+
+static inline Slab* slabOf(void* ptr) {
+    return (Slab*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+// Function declarations
+void slabCacheInit(SlabCache* cache, unsigned arena);
+void* slabMalloc(SlabCache* cache, size_t size);
+void slabFree(SlabCache* cache, void* ptr);
+size_t slabTrim(size_t* keep);
+void slabNewEpoch(void);
+char* slabLimit(void);
+void slabLockSpace(void);
+void slabUnlockSpace(void);
+
+#endif
@@ -0,0 +1,31 @@
+#include <stdbool.h>
+#include "stats.h"
+
+size_t statCalls[STAT_CALL_KINDS];
+static size_t mappedBytes = 0;
+static size_t peakMappedBytes = 0;
+
+void statsMapped(size_t bytes) {
+    size_t mapped = __atomic_add_fetch(&mappedBytes, bytes, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peakMappedBytes, __ATOMIC_RELAXED);
+    while (mapped > peak &&
+           !__atomic_compare_exchange_n(&peakMappedBytes, &peak, mapped, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void statsUnmapped(size_t bytes) {
+    __atomic_sub_fetch(&mappedBytes, bytes, __ATOMIC_RELAXED);
+}
+
+size_t statsMappedBytes(void) {
+    return __atomic_load_n(&mappedBytes, __ATOMIC_RELAXED);
+}
+
+size_t statsPeakMappedBytes(void) {
+    return __atomic_load_n(&peakMappedBytes, __ATOMIC_RELAXED);
+}
+
+size_t statsCalls(StatCall call) {
+    return __atomic_load_n(&statCalls[call], __ATOMIC_RELAXED);
+}
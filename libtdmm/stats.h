@@ -0,0 +1,56 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+// Process-wide counters behind t_stats, kept with relaxed atomics. Mapped
+// bytes cover the memory blocks are carved from: heap and buddy regions,
+// committed slab space and large blocks, not the allocator's own tables.
+// Like the system call counts they run for the life of the process, since
+// t_init leaves the previous heap mapped.
+
+typedef enum {
+    STAT_MMAP,
+    STAT_MUNMAP,
+    STAT_MREMAP,
+    STAT_MADVISE,
+    STAT_MPROTECT,
+    STAT_CALL_KINDS
+} StatCall;
+
+extern size_t statCalls[STAT_CALL_KINDS];
+
+// Counters for one kind of space blocks are handed out from: an arena's
+// heap regions, its slabs or its buddy heap, or the large mappings. Written
+// only under the owner's lock, with statAdd and statSub, so t_stats can
+// read them without taking it; the large mappings, which have no lock, use
+// atomic adds instead.
+typedef struct SpaceStats {
+    size_t regions;            // mappings, or slabs
+    size_t space;              // bytes the blocks take up, headers included
+    size_t blocks;             // blocks, free or allocated
+    size_t allocated;          // payload bytes of allocated blocks
+} SpaceStats;
+
+// the owner's lock makes the read-modify-write safe
+static inline void statAdd(size_t* counter, size_t delta) {
+    __atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+}
+
+static inline void statSub(size_t* counter, size_t delta) {
+    __atomic_store_n(counter, *counter - delta, __ATOMIC_RELAXED);
+}
+
+// counts one system call, made or attempted
+static inline void statsCall(StatCall call) {
+    __atomic_fetch_add(&statCalls[call], 1, __ATOMIC_RELAXED);
+}
+
+// Function declarations
+void statsMapped(size_t bytes);
+void statsUnmapped(size_t bytes);
+size_t statsMappedBytes(void);
+size_t statsPeakMappedBytes(void);
+size_t statsCalls(StatCall call);
+
+#endif
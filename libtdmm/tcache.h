@@ -0,0 +1,70 @@
+#ifndef TCACHE_H
+#define TCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per-thread cache of recently freed small blocks. Bin b holds blocks with
+// at least b * TCACHE_GRANULE usable bytes, linked through their first word.
+#define TCACHE_GRANULE 16
+#define TCACHE_MAX_SIZE 1024
+#define TCACHE_BINS (TCACHE_MAX_SIZE / TCACHE_GRANULE + 1)
+#define TCACHE_BIN_CAPACITY 32  // blocks kept per bin before flushing
+#define TCACHE_BATCH 16         // blocks moved per refill or flush
+
+typedef struct TCache {
+    void* heads[TCACHE_BINS];
+    uint16_t counts[TCACHE_BINS];
+    unsigned generation;  // heap generation the cached blocks belong to
+    bool registered;      // thread-exit destructor installed
+    bool busy;            // held by whoever is using the bins, see tcacheLock
+    struct TCache* prevCache;  // every registered cache, for t_gcollect
+    struct TCache* nextCache;
+} TCache;
+
+// bin that can serve a request of size bytes, 0 if it is not cacheable
+static inline size_t tcacheRequestBin(size_t size) {
+    if (size == 0 || size > TCACHE_MAX_SIZE)
+        return 0;
+    return (size + TCACHE_GRANULE - 1) / TCACHE_GRANULE;
+}
+
+// bin a block with usable bytes belongs in, 0 if it is not cacheable
+static inline size_t tcacheBlockBin(size_t usable) {
+    size_t bin = usable / TCACHE_GRANULE;
+    return bin < TCACHE_BINS ? bin : 0;
+}
+
+// The owner uses its bins without the arena lock, so t_gcollect, which
+// drains every thread's cache, must not touch a cache while its owner is
+// inside one of those lock-free sections. Both take this flag around them;
+// the owner's other cache accesses hold its arena lock, which t_gcollect
+// holds as well.
+static inline void tcacheLock(TCache* cache) {
+    while (__atomic_exchange_n(&cache->busy, true, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&cache->busy, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static inline void tcacheUnlock(TCache* cache) {
+    __atomic_store_n(&cache->busy, false, __ATOMIC_RELEASE);
+}
+
+static inline void tcachePush(TCache* cache, size_t bin, void* ptr) {
+    *(void**)ptr = cache->heads[bin];
+    cache->heads[bin] = ptr;
+    cache->counts[bin]++;
+}
+
+static inline void* tcachePop(TCache* cache, size_t bin) {
+    void* ptr = cache->heads[bin];
+    if (ptr != NULL) {
+        cache->heads[bin] = *(void**)ptr;
+        cache->counts[bin]--;
+    }
+    return ptr;
+}
+
+#endif
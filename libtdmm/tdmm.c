@@ -4,16 +4,80 @@
 #include <stdint.h>
 #include <string.h>
 #include "doublell.h"
+#include "sizeclass.h"
+#include "sizetree.h"
+#include "buddy.h"
+#include "tcache.h"
+#include "arena.h"
+#include "slab.h"
+#include "large.h"
+#include "regiontable.h"
+#include "gc.h"
+#include "hugepage.h"
+#include "trace.h"
+#include "bump.h"
+#include "stats.h"
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
 
 
-#define ALIGNMENT 16
+#define REGION_GRANULE 4096 // regions are mapped in whole pages
+#define REGION_INITIAL_SIZE ((size_t)64 * 1024)      // first region extendHeap maps
+#define REGION_MAX_SIZE ((size_t)32 * 1024 * 1024)   // regions stop doubling here
+#define TRIM_THRESHOLD_DEFAULT ((size_t)128 * 1024)
 
-alloc_strat_e stratChosen = FIRST_FIT; // default
-void* mmapRegion = NULL;
+void* mmapRegion = NULL;               // first region of arena 0
 
-BlockList* blockList = NULL;
-static int sequential_counter = 0; // for sequential allocation round robin
+RegionList* regionList = NULL;         // arena 0's regions
+
+// Each arena's state is only touched with that arena's lock held, except
+// remoteFrees, which other threads push onto without it.
+static Arena arenas[MAX_ARENAS];
+static unsigned arenaCount = 1;
+static unsigned nextArena = 0;      // round-robin assignment of threads
+static pthread_mutex_t initLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned heapGeneration = 0; // bumped by t_init to invalidate thread state
+
+// A heap is a run of arenas. heaps[0] is the default heap behind the t_*
+// functions, arenas [0, arenaCount); t_heap_create hands out the others
+// with arenas of their own above those. Creating and destroying heaps takes
+// heapsLock, then the arena locks.
+#define MAX_HEAPS 64
+
+struct t_heap {
+  unsigned first;                   // arenas[first, first + count)
+  unsigned count;
+  bool live;
+};
+
+static struct t_heap heaps[MAX_HEAPS];
+static bool arenaTaken[MAX_ARENAS];
+static pthread_mutex_t heapsLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned nextHeapThread = 0; // spreads threads over a heap's arenas
+
+// Free blocks at least this big have their interior pages released with
+// madvise as soon as they form, except for the first trimThreshold bytes:
+// allocations are carved from the front of a free block, so keeping that
+// pad resident stops a heap that shrinks and regrows from faulting the same
+// pages back in over and over. TDMM_TRIM_LAZY selects MADV_FREE, which
+// lets the kernel reclaim the pages only under memory pressure.
+static size_t trimThreshold = TRIM_THRESHOLD_DEFAULT;
+static int trimAdvice = MADV_DONTNEED;
+
+// The thread caches below are private to their thread.
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+static __thread TCache threadCacheData;
+static __thread Arena* threadArena = NULL;
+static __thread unsigned heapThread = 0;  // 1 + this thread's index, once a heap needed it
+static __thread uint64_t randomState = 0; // xorshift state for RANDOM
+static TCache* cacheList = NULL;          // every registered cache, for t_gcollect
+static pthread_mutex_t cacheListLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t forkOnce = PTHREAD_ONCE_INIT;
 
 
 void* align_ptr(void* ptr, size_t alignment) {
@@ -22,270 +86,448 @@ void* align_ptr(void* ptr, size_t alignment) {
   return (void*)aligned;
 }
 
+// Every free block is reachable both through its size class (first fit)
+// and through the size tree (best and worst fit).
+// The log2 size histogram for t_frag_stats is kept here as well, which
+// works because a block never changes size while it is indexed.
+static unsigned freeBin(size_t size) {
+  return 63 - (unsigned)__builtin_clzll((unsigned long long)size);
+}
+
+static void indexFreeBlock(Arena* arena, FreeBlock* block) {
+  pushFreeBlock(&arena->freeLists, block);
+  insertSizeTree(&arena->sizeTree, block);
+  arena->freeBins[freeBin(block->header.size)]++;
+  arena->freeBytes += block->header.size;
+}
+
+static void unindexFreeBlock(Arena* arena, FreeBlock* block) {
+  popFreeBlock(&arena->freeLists, block);
+  removeSizeTree(&arena->sizeTree, block);
+  arena->freeBins[freeBin(block->header.size)]--;
+  arena->freeBytes -= block->header.size;
+}
+
+// a region joins or leaves the arena's heap as one free block
+static void countRegion(Arena* arena, Region* region, bool added) {
+  size_t space = region->size - sizeof(Region) - sizeof(Block);
+  if (added) {
+    statAdd(&arena->stats.regions, 1);
+    statAdd(&arena->stats.space, space);
+    statAdd(&arena->stats.blocks, 1);
+  } else {
+    statSub(&arena->stats.regions, 1);
+    statSub(&arena->stats.space, space);
+    statSub(&arena->stats.blocks, 1);
+  }
+}
+
+// payload size actually reserved for a request, 0 if it cannot be served
+static size_t requestPayload(size_t size) {
+  if (size > SIZE_MAX / 2) {
+    return 0;
+  }
+  if (size < MIN_PAYLOAD) {
+    return MIN_PAYLOAD;
+  }
+  return (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+
+static void initArena(Arena* arena, unsigned index, alloc_strat_e strategy, bool isolated) {
+  pthread_mutex_init(&arena->lock, NULL);
+  initRegionList(&arena->regions);
+  releaseFreeLists(&arena->freeLists);
+  initSizeTree(&arena->sizeTree);
+  buddyInit(&arena->buddy, index);
+  slabCacheInit(&arena->slabs, index);
+  arena->nextRegionSize = REGION_INITIAL_SIZE;
+  arena->strategy = strategy;
+  arena->isolated = isolated;
+  memset(&arena->stats, 0, sizeof(arena->stats));
+  memset(arena->freeBins, 0, sizeof(arena->freeBins));
+  arena->freeBytes = 0;
+  arena->sequentialCounter = 0;
+  adaptInit(&arena->adapt);
+  arena->remoteFrees = NULL;
+  arena->index = index;
+}
+
+// Lays out a fresh mapping as a region: the header, one free block spanning
+// the rest, and the end sentinel. Returns the free block, or NULL (with the
+// mapping undone) if the region table cannot take it.
+static FreeBlock* initRegion(Arena* arena, void* mem, size_t regionSize, bool huge) {
+  if (!regionTableInsert(mem, regionSize, arena->index, KIND_HEAP)) {
+    unmapRegion(mem, regionSize, huge);
+    return NULL;
+  }
+
+  Region* region = (Region*)mem;
+  region->size = regionSize;
+  region->arena = arena->index;
+  region->huge = huge;
+  insertRegionBack(&arena->regions, region);
+
+  Block* block = firstBlock(region);
+  block->size = regionSize - sizeof(Region) - 2 * sizeof(Block);
+  block->arena = (uint16_t)arena->index;
+  block->flags = BLOCK_FREE | BLOCK_ZEROED;
+  block->kind = KIND_HEAP;
+  *blockFooter(block) = block->size;
+
+  Block* sentinel = nextBlock(block);
+  sentinel->size = 0;
+  sentinel->arena = block->arena;
+  sentinel->flags = BLOCK_PREV_FREE;
+  sentinel->kind = KIND_HEAP;
+  sentinel->regionOffset = (uint32_t)(((char*)sentinel - (char*)region) / ALIGNMENT);
+
+  indexFreeBlock(arena, (FreeBlock*)block);
+  countRegion(arena, region, true);
+  return (FreeBlock*)block;
+}
+
+// number of arenas: TDMM_ARENAS if set, otherwise one per online CPU
+static unsigned chooseArenaCount(void) {
+  long count = 0;
+  const char* env = getenv("TDMM_ARENAS");
+  if (env) {
+    count = strtol(env, NULL, 10);
+  }
+  if (count <= 0) {
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (count < 1) count = 1;
+  if (count > MAX_HEAP_ARENAS) count = MAX_HEAP_ARENAS;
+  return (unsigned)count;
+}
+
+// A fork() while another thread is inside the allocator would leave that
+// thread's locks held forever in the child, so every lock is taken around
+// the fork, in the order t_gcollect uses, and released on both sides.
+static void prepareFork(void) {
+  pthread_mutex_lock(&heapsLock);
+  for (unsigned h = 0; h < MAX_HEAPS; h++) {
+    if (!heaps[h].live) continue;
+    for (unsigned i = heaps[h].first; i < heaps[h].first + heaps[h].count; i++) {
+      pthread_mutex_lock(&arenas[i].lock);
+    }
+  }
+  pthread_mutex_lock(&cacheListLock);
+  slabLockSpace();
+  regionTableLock();
+}
+
+static void unlockAfterFork(void) {
+  slabUnlockSpace();
+  pthread_mutex_unlock(&cacheListLock);
+  for (unsigned h = MAX_HEAPS; h-- > 0;) {
+    if (!heaps[h].live) continue;
+    for (unsigned i = heaps[h].first + heaps[h].count; i-- > heaps[h].first;) {
+      pthread_mutex_unlock(&arenas[i].lock);
+    }
+  }
+  pthread_mutex_unlock(&heapsLock);
+}
+
+static void finishFork(void) {
+  regionTableUnlock();
+  unlockAfterFork();
+}
+
+static void finishForkChild(void) {
+  // threads that were inside their cache at the fork do not exist here
+  for (TCache* cache = cacheList; cache; cache = cache->nextCache) {
+    cache->busy = false;
+  }
+  regionTableUnlockChild();
+  unlockAfterFork();
+}
+
+static void registerForkHandlers(void) {
+  pthread_atfork(prepareFork, finishFork, finishForkChild);
+}
+
 void t_init(alloc_strat_e strat) {
-  stratChosen = strat;
+  pthread_mutex_lock(&initLock);
+  heapGeneration++;
+
+  arenaCount = chooseArenaCount();
+  nextArena = 0;
+  for (unsigned i = 0; i < arenaCount; i++) {
+    initArena(&arenas[i], i, strat, false);
+  }
+
+  // heaps from t_heap_create are abandoned along with the old default heap
+  pthread_mutex_lock(&heapsLock);
+  memset(heaps, 0, sizeof(heaps));
+  memset(arenaTaken, 0, sizeof(arenaTaken));
+  heaps[0].count = arenaCount;
+  heaps[0].live = true;
+  for (unsigned i = 0; i < arenaCount; i++) {
+    arenaTaken[i] = true;
+  }
+  pthread_mutex_unlock(&heapsLock);
+  regionList = &arenas[0].regions;
+  pthread_once(&forkOnce, registerForkHandlers);
+  regionTableReset();
+  slabNewEpoch();
+  largeInit();
+  hugePagesInit();
+  traceInit();
+
+  const char* trimEnv = getenv("TDMM_TRIM_THRESHOLD");
+  trimThreshold = trimEnv && *trimEnv ? (size_t)strtoull(trimEnv, NULL, 10) : TRIM_THRESHOLD_DEFAULT;
+  trimAdvice = MADV_DONTNEED;
+#ifdef MADV_FREE
+  if (getenv("TDMM_TRIM_LAZY")) {
+    trimAdvice = MADV_FREE;
+  }
+#endif
 
-  size_t totalSize = 16384; // 4 pages of memory
-  mmapRegion = mmap(NULL, totalSize, PROT_READ | PROT_WRITE,
-                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  size_t totalSize = regionMapSize(16384); // 4 pages of memory, or one huge page
+  bool huge;
+  mmapRegion = mapRegion(totalSize, &huge);
 
-  if (mmapRegion == MAP_FAILED) {
+  if (mmapRegion == NULL) {
     perror("mmap failed");
+    pthread_mutex_unlock(&initLock);
     return;
   }
 
-  // Reserve space for BlockList at the beginning of mmapRegion.
-  // This avoids calling malloc.
-  blockList = (BlockList*)mmapRegion;
-  blockList->head = NULL;
-  blockList->tail = NULL;
-  blockList->count = 0;
-
-  // Calculate where the user space starts, after the BlockList.
-  void* metadataEnd = (char*)mmapRegion + sizeof(BlockList);
-  void* userRegion = align_ptr(metadataEnd, ALIGNMENT);
-
-  // create the first free block in the remaining memory
-  Block* block = (Block*)userRegion;
-  size_t overhead = (char*)userRegion - (char*)mmapRegion;
-  block->size = totalSize - overhead;
-  block->free = true;
-  block->prev = NULL;
-  block->next = NULL;
-
-  // insert the block into blockList (which is stored in the mmap region)
-  blockList->head = block;
-  blockList->tail = block;
-  blockList->count = 1;
-}
-
-Block* extendHeap(size_t size) {
-  // Choose a new region size: either a minimum (e.g., 16384 bytes) or just big enough for the request.
-  size_t minRegionSize = 16384;
-  size_t newRegionSize = (size + sizeof(Block) + ALIGNMENT) * 2;
-  
+  // The other arenas map their first region on their first allocation.
+  if (!initRegion(&arenas[0], mmapRegion, totalSize, huge)) {
+    mmapRegion = NULL;
+  }
+  pthread_mutex_unlock(&initLock);
+}
+
+FreeBlock* extendHeap(Arena* arena, size_t size) {
+  // Regions grow geometrically, each twice the last up to REGION_MAX_SIZE,
+  // so a growing heap needs O(log n) mmaps and TLB entries stay few. A
+  // request bigger than that gets a region just large enough for it.
+  size_t newRegionSize = arena->nextRegionSize;
+  if (newRegionSize < size + sizeof(Region) + 2 * sizeof(Block)) {
+    newRegionSize = size + sizeof(Region) + 2 * sizeof(Block);
+  }
+  // whole pages, or whole huge pages when those are turned on
+  newRegionSize = regionMapSize(newRegionSize);
+  if (!newRegionSize) {
+    return NULL;
+  }
+  // the sentinel finds its region through a 32-bit offset
+  if (newRegionSize / ALIGNMENT > UINT32_MAX) {
+    return NULL;
+  }
+  if (arena->nextRegionSize < REGION_MAX_SIZE) {
+    arena->nextRegionSize *= 2;
+  }
+
   // Allocate a new region with mmap.
-  void* newRegion = mmap(NULL, newRegionSize, PROT_READ | PROT_WRITE,
-                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (newRegion == MAP_FAILED) {
+  bool huge;
+  void* newRegion = mapRegion(newRegionSize, &huge);
+  if (newRegion == NULL) {
       perror("mmap in extend_heap failed");
       return NULL;
   }
-  
-  // Align the pointer (if needed) and initialize a new free block.
-  Block* newBlock = (Block*) align_ptr(newRegion, ALIGNMENT);
-  size_t overhead = (char*)newBlock - (char*)newRegion;
-  newBlock->size = newRegionSize - overhead - sizeof(Block);
-  newBlock->free = true;
-  newBlock->prev = blockList->tail;  // Link this block to the end of our list.
-  newBlock->next = NULL;
-  
-  // Insert newBlock at the end of the block list.
-  if (blockList->tail) {
-      blockList->tail->next = newBlock;
+
+  return initRegion(arena, newRegion, newRegionSize, huge);
+}
+
+// Takes a free block out of the free structures, splits off the unused tail
+// as a new free block when it is large enough, and returns the user pointer.
+static void* allocateBlock(Arena* arena, FreeBlock* freeBlock, size_t size) {
+  Block* block = &freeBlock->header;
+  unindexFreeBlock(arena, freeBlock);
+
+  // if the block is large enough, split it.
+  if (block->size >= size + sizeof(Block) + MIN_PAYLOAD) {
+      Block* rest = (Block*)((char*)block + sizeof(Block) + size);
+      rest->size = block->size - size - sizeof(Block);
+      rest->arena = block->arena;
+      // rest's interior pages lie inside block's, so a release carries over
+      rest->flags = BLOCK_FREE | (block->flags & (BLOCK_ZEROED | BLOCK_TRIMMED));
+      rest->kind = KIND_HEAP;
+      *blockFooter(rest) = rest->size;
+      block->size = size;
+      // the block after rest keeps BLOCK_PREV_FREE
+      indexFreeBlock(arena, (FreeBlock*)rest);
+      statAdd(&arena->stats.blocks, 1);
   } else {
-      // In case blockList was empty.
-      blockList->head = newBlock;
-  }
-  blockList->tail = newBlock;
-  blockList->count++;
-  
-  return newBlock;
-}
-
-void* firstFit(size_t size) {
-  Block* firstFitBlock = NULL;
-  Block* current = blockList->head;
-  
-  // find the first free block that fits the requested size.
-  while (current != NULL) {
-      if (current->free && current->size >= size) {
-          firstFitBlock = current;
-          break;
-      }
-      current = current->next;
+      nextBlock(block)->flags &= (uint8_t)~BLOCK_PREV_FREE;
   }
-  
+
+  // mark the block as allocated; its predecessor is never free here because
+  // free neighbours are always merged. BLOCK_ZEROED is only looked at by
+  // t_calloc right after this returns; blocks handed out any other way keep
+  // a stale bit that nothing reads again before strategyFree rewrites it.
+  block->flags &= BLOCK_ZEROED;
+  statAdd(&arena->stats.allocated, block->size);
+
+  // Return pointer to the usable memory (after the block header).
+  return blockPayload(block);
+}
+
+void* firstFit(Arena* arena, size_t size) {
+  size = requestPayload(size);
+  if (!size) return NULL;
+
+  // only free blocks are indexed, and the bitmaps skip empty classes, so this
+  // does not depend on how many blocks are allocated.
+  FreeBlock* firstFitBlock = findFreeBlock(&arena->freeLists, size);
+
   // check if a suitable block was found.
   if (!firstFitBlock) {
-      firstFitBlock = extendHeap(size);
+      firstFitBlock = extendHeap(arena, size);
       if (!firstFitBlock) { // getting more memory from the OS through mmap did not work
         return NULL;
       }
   }
-  
-  // if the block is large enough, split it.
-  if (firstFitBlock->size >= size + sizeof(Block) + ALIGNMENT) {
-      Block* newBlock = (Block*)((char*)firstFitBlock + sizeof(Block) + size);
-      newBlock->size = firstFitBlock->size - size - sizeof(Block);
-      newBlock->free = true;
-      newBlock->next = firstFitBlock->next;
-      newBlock->prev = firstFitBlock;
-      if (newBlock->next != NULL) {
-          newBlock->next->prev = newBlock;
-      } else {
-          // if firstFitBlock was the tail, update the tail pointer.
-          blockList->tail = newBlock;
-      }
-      firstFitBlock->next = newBlock;
-      firstFitBlock->size = size;
-  }
-  
-  // mark the block as allocated.
-  firstFitBlock->free = false;
-  
-  // Return pointer to the usable memory (after the block header).
-  return (void*)((char*)firstFitBlock + sizeof(Block));
-}
-
-void* bestFit(size_t size) {
-  Block* bestFitBlock = NULL;
-  Block* current = blockList->head;
-    int index = 0;
-    while (current != NULL) {
-        if (current->free && current->size >= size) {
-          if (!bestFitBlock || current->size < bestFitBlock->size) {
-            bestFitBlock = current;
-            break;
-          }
-        }
-        current = current->next;
-    }
-  
+
+  return allocateBlock(arena, firstFitBlock, size);
+}
+
+void* bestFit(Arena* arena, size_t size) {
+  size = requestPayload(size);
+  if (!size) return NULL;
+
+  // smallest block that fits, lowest address among equal sizes: O(log n)
+  FreeBlock* bestFitBlock = lowerBoundSizeTree(&arena->sizeTree, size);
+
   // get more memory if needed
   if (!bestFitBlock) {
-    bestFitBlock = extendHeap(size);
+    bestFitBlock = extendHeap(arena, size);
     if (!bestFitBlock) {
       return NULL;
     }
   }
 
-  // if the block is large enough, split it.
-  if (bestFitBlock->size >= size + sizeof(Block) + ALIGNMENT) {
-      Block* newBlock = (Block*)((char*)bestFitBlock + sizeof(Block) + size);
-      newBlock->size = bestFitBlock->size - size - sizeof(Block);
-      newBlock->free = true;
-      newBlock->next = bestFitBlock->next;
-      newBlock->prev = bestFitBlock;
-      if (newBlock->next != NULL) {
-          newBlock->next->prev = newBlock;
-      } else {
-          // if firstFitBlock was the tail, update the tail pointer.
-          blockList->tail = newBlock;
-      }
-      bestFitBlock->next = newBlock;
-      bestFitBlock->size = size;
-  }
+  return allocateBlock(arena, bestFitBlock, size);
+}
 
-  // mark the block as allocated.
-  bestFitBlock->free = false;
 
-  // Return pointer to the usable memory (after the block header).
-  return (void*)((char*)bestFitBlock + sizeof(Block));
-}
+void* worstFit(Arena* arena, size_t size) {
+  size = requestPayload(size);
+  if (!size) return NULL;
 
+  // largest free block, used only if it is big enough: O(log n)
+  FreeBlock* worstFitBlock = maxSizeTree(&arena->sizeTree);
+  if (worstFitBlock && worstFitBlock->header.size < size) {
+    worstFitBlock = NULL;
+  }
 
-void* worstFit(size_t size) {
-  Block* worstFitBlock = NULL;
-  Block* current = blockList->head;
-    int index = 0;
-    while (current != NULL) {
-        if (current->free && current->size >= size) {
-          if (!worstFitBlock || current->size > worstFitBlock->size) {
-            worstFitBlock = current;
-            break;
-          }
-        }
-        current = current->next;
-    }
-  
   // get more memory if needed
   if (!worstFitBlock) {
-    worstFitBlock = extendHeap(size);
+    worstFitBlock = extendHeap(arena, size);
     if (!worstFitBlock) {
       return NULL;
     }
   }
 
-  // if the block is large enough, split it.
-  if (worstFitBlock->size >= size + sizeof(Block) + ALIGNMENT) {
-      Block* newBlock = (Block*)((char*)worstFitBlock + sizeof(Block) + size);
-      newBlock->size = worstFitBlock->size - size - sizeof(Block);
-      newBlock->free = true;
-      newBlock->next = worstFitBlock->next;
-      newBlock->prev = worstFitBlock;
-      if (newBlock->next != NULL) {
-          newBlock->next->prev = newBlock;
-      } else {
-          // if firstFitBlock was the tail, update the tail pointer.
-          blockList->tail = newBlock;
-      }
-      worstFitBlock->next = newBlock;
-      worstFitBlock->size = size;
+  return allocateBlock(arena, worstFitBlock, size);
+}
+
+
+
+// rand() keeps hidden global state, so RANDOM uses a per-thread xorshift
+static unsigned nextRandom(void) {
+  if (randomState == 0) {
+    randomState = (uint64_t)(uintptr_t)&threadCacheData ^ 0x9E3779B97F4A7C15ull;
   }
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 7;
+  randomState ^= randomState << 17;
+  return (unsigned)(randomState >> 32);
+}
 
-  // mark the block as allocated.
-  worstFitBlock->free = false;
+// first, best or worst fit, numbered as in alloc_strat_e
+static void* fitByPolicy(Arena* arena, unsigned policy, size_t size) {
+  switch (policy) {
+    case 0:
+      return firstFit(arena, size);
+    case 1:
+      return bestFit(arena, size);
+    default:
+      return worstFit(arena, size);
+  }
+}
 
-  // Return pointer to the usable memory (after the block header).
-  return (void*)((char*)worstFitBlock + sizeof(Block));
+static uint64_t nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
+// 1 - largest free block / free bytes, as in t_frag_stats
+static double arenaFragmentation(Arena* arena) {
+  FreeBlock* largest = maxSizeTree(&arena->sizeTree);
+  if (!largest || arena->freeBytes == 0) {
+    return 0;
+  }
+  return 1 - (double)largest->header.size / (double)arena->freeBytes;
+}
 
+// ADAPTIVE: the request's size class runs the policy the arena has learned
+// for it. A sample of the calls is timed and any heap growth is charged to
+// the class; at the end of each epoch the arena's AdaptState weighs the
+// policies again.
+static void* adaptiveMalloc(Arena* arena, size_t size) {
+  unsigned cls = adaptClass(size);
+  AdaptClass* c = &arena->adapt.classes[cls];
+  bool timed = adaptTimed(c);
+  size_t space = arena->stats.space;
+  uint64_t start = timed ? nowNs() : 0;
 
-void *
-t_malloc (size_t size)
+  void* ptr = fitByPolicy(arena, c->trial, size);
+  if (!ptr) {
+    return NULL;
+  }
+  // the free is counted in the same class, whatever the block's size
+  payloadBlock(ptr)->adaptClass = cls;
+
+  uint64_t ns = timed ? nowNs() - start : 0;
+  size_t grown = arena->stats.space > space ? arena->stats.space - space : 0;
+  if (adaptRecord(c, timed, ns, grown)) {
+    adaptDecide(&arena->adapt, cls, arenaFragmentation(arena), arena->freeBytes);
+  }
+  return ptr;
+}
+
+// Runs the chosen strategy without the slab layer. Caller holds arena->lock.
+static void* heapMalloc(Arena* arena, size_t size)
 {
   void* ptr = NULL;
-  switch (stratChosen) {
+  switch (arena->strategy) {
     case FIRST_FIT:
-      ptr = firstFit(size);
+      ptr = firstFit(arena, size);
       break;
 
     case BEST_FIT:
-      ptr = bestFit(size);
+      ptr = bestFit(arena, size);
       break;
-    
+
     case WORST_FIT:
-      ptr = worstFit(size);
+      ptr = worstFit(arena, size);
       break;
-    
+
     case BUDDY:
-      ptr = worstFit(size);
+      ptr = buddyMalloc(&arena->buddy, size);
       break;
       case SEQUENTIAL: {
         // Sequential allocation: use round-robin among firstFit, bestFit, and worstFit.
-        int method = sequential_counter % 3;
-        sequential_counter++;
-        switch (method) {
-          case 0:
-            ptr = firstFit(size);
-            break;
-          case 1:
-            ptr = bestFit(size);
-            break;
-          case 2:
-            ptr = worstFit(size);
-            break;
-        }
+        int method = arena->sequentialCounter % 3;
+        arena->sequentialCounter++;
+        ptr = fitByPolicy(arena, method, size);
         break;
       }
       case RANDOM: {
         // Random allocation: choose one of the three methods at random.
-        int method = rand() % 3;
-        switch (method) {
-          case 0:
-            ptr = firstFit(size);
-            break;
-          case 1:
-            ptr = bestFit(size);
-            break;
-          case 2:
-            ptr = worstFit(size);
-            break;
-        }
+        int method = nextRandom() % 3;
+        ptr = fitByPolicy(arena, method, size);
         break;
       }
+    case ADAPTIVE:
+      ptr = adaptiveMalloc(arena, size);
+      break;
     default:
       // printf("unknown allocation strategy/allocation type not implemented.");
       break;
@@ -293,47 +535,1157 @@ t_malloc (size_t size)
   return ptr;
 }
 
+// Runs the chosen strategy. Caller holds arena->lock.
+static void* strategyMalloc(Arena* arena, size_t size)
+{
+  // small objects come from slabs whatever the strategy, except in heaps
+  // that must be able to unmap everything they own region by region
+  void* ptr = arena->isolated ? NULL : slabMalloc(&arena->slabs, size);
+  if (ptr) return ptr;
+  return heapMalloc(arena, size);
+}
 
-void 
-t_free (void *ptr) {
-  if (!ptr) return; 
+
+// The whole pages of a free block's payload past its links and its first
+// pad bytes and before its footer; they can be handed back to the kernel
+// without losing the block. The range is empty if start >= end.
+static void freeInterior(Block* block, size_t pad, uintptr_t* start, uintptr_t* end) {
+  uintptr_t payload = (uintptr_t)blockPayload(block);
+  uintptr_t from = payload + (sizeof(FreeBlock) - sizeof(Block));
+  if (pad > block->size) pad = block->size;
+  if (payload + pad > from) from = payload + pad;
+  *start = (from + REGION_GRANULE - 1) & ~(uintptr_t)(REGION_GRANULE - 1);
+  *end = (uintptr_t)blockFooter(block) & ~(uintptr_t)(REGION_GRANULE - 1);
+}
+
+// Releases a free block's interior pages past the resident pad, skipping
+// [start, doneUpTo) and [doneFrom, end), which a merged neighbour had
+// already released.
+static void releaseInterior(Block* block, uintptr_t doneUpTo, uintptr_t doneFrom) {
+  uintptr_t start, end;
+  freeInterior(block, __atomic_load_n(&trimThreshold, __ATOMIC_RELAXED), &start, &end);
+  if (doneUpTo > start) start = doneUpTo;
+  if (doneFrom && doneFrom < end) end = doneFrom;
+  if (end > start) {
+    statsCall(STAT_MADVISE);
+    madvise((void*)start, end - start, trimAdvice);
+  }
+  block->flags |= BLOCK_TRIMMED;
+}
+
+// Unmaps a region that is one free block from header to sentinel.
+static void releaseRegion(Arena* arena, Region* region) {
+  unindexFreeBlock(arena, (FreeBlock*)firstBlock(region));
+  countRegion(arena, region, false);
+  removeRegion(&arena->regions, region);
+  regionTableRemove(region);
+  if (unmapRegion(region, region->size, region->huge) != 0) {
+    perror("munmap in releaseRegion failed");
+  }
+}
+
+// Returns the block to the strategy's free structures. Caller holds arena->lock
+// and arena owns the block.
+static void strategyFree(Arena* arena, void *ptr) {
+  // slab objects have no header; the slab is found by masking the pointer
+  if (isSlabPointer(ptr)) {
+    slabFree(&arena->slabs, ptr);
+    return;
+  }
 
   // step 1: Get the block header from the user pointer.
-  Block *block = (Block *)((char *)ptr - sizeof(Block));
+  Block *block = payloadBlock(ptr);
 
-  // step 2: Mark the block as free
-  block->free = true;
+  // buddy blocks carry their own header and live in their own regions
+  if (block->kind == KIND_BUDDY) {
+    buddyFree(&arena->buddy, ptr);
+    return;
+  }
+  statSub(&arena->stats.allocated, block->size);
+
+  // pages the merged neighbours already released need no second madvise
+  uintptr_t doneUpTo = 0, doneFrom = 0, unused;
 
-  // step 3: Coalesce with previous block if it's free
-  if (block->prev && block->prev->free) {
-      Block *prev = block->prev;
-      // merge current block into previous block:
+  // step 2: coalesce with the physical predecessor, found through its footer.
+  if (block->flags & BLOCK_PREV_FREE) {
+      Block *prev = prevBlock(block);
+      if (prev->flags & BLOCK_TRIMMED) freeInterior(prev, trimThreshold, &unused, &doneUpTo);
+      // prev changes size, so it has to leave its size class first.
+      unindexFreeBlock(arena, (FreeBlock*)prev);
       prev->size += sizeof(Block) + block->size;
-      prev->next = block->next;
-      if (block->next) {
-          block->next->prev = prev;
-      } else {
-          // update tail pointer if needed.
-          blockList->tail = prev;
-      }
+      statSub(&arena->stats.blocks, 1);
       block = prev;  // use the merged block for further coalescing.
   }
 
-  // step 4: coalesce with next block if it's free.
-  if (block->next && block->next->free) {
-      Block *next = block->next;
+  // step 3: coalesce with the physical successor. The region's sentinel is
+  // never free, so this cannot run past the end of the region.
+  Block *next = nextBlock(block);
+  if (next->flags & BLOCK_FREE) {
+      if (next->flags & BLOCK_TRIMMED) freeInterior(next, trimThreshold, &doneFrom, &unused);
+      unindexFreeBlock(arena, (FreeBlock*)next);
       block->size += sizeof(Block) + next->size;
-      block->next = next->next;
-      if (next->next) {
-          next->next->prev = block;
+      statSub(&arena->stats.blocks, 1);
+  }
+
+  // step 4: a region that is free from end to end goes back to the kernel,
+  // unless it is the arena's newest one, which the next growth would only
+  // map again; its interior is released below like any large free block.
+  Block *after = nextBlock(block);
+  if (isSentinel(after)) {
+      Region *region = sentinelRegion(after);
+      if (firstBlock(region) == block && region != arena->regions.tail) {
+          countRegion(arena, region, false);
+          removeRegion(&arena->regions, region);
+          regionTableRemove(region);
+          if (unmapRegion(region, region->size, region->huge) != 0) {
+              perror("munmap in strategyFree failed");
+          }
+          return;
+      }
+  }
+
+  // step 5: write the boundary tags and file the block under its size class.
+  // A large free block also gives its interior pages back.
+  block->flags = BLOCK_FREE;
+  if (block->size >= __atomic_load_n(&trimThreshold, __ATOMIC_RELAXED)) {
+    releaseInterior(block, doneUpTo, doneFrom);
+  }
+  *blockFooter(block) = block->size;
+  nextBlock(block)->flags |= BLOCK_PREV_FREE;
+  indexFreeBlock(arena, (FreeBlock*)block);
+}
+
+// Returns a block the program is done with to the arena. Unlike the
+// tails and lead-ins strategyFree also takes back, it was handed out by
+// the arena, so ADAPTIVE counts it as a free. Caller holds arena->lock.
+static void releaseBlock(Arena* arena, void* ptr) {
+  if (arena->strategy == ADAPTIVE && !isSlabPointer(ptr)) {
+    Block* block = payloadBlock(ptr);
+    if (block->kind == KIND_HEAP) adaptFree(&arena->adapt, block->adaptClass);
+  }
+  strategyFree(arena, ptr);
+}
+
+// bytes the caller may use at ptr; only reads the block's own header
+static size_t usableSize(void* ptr) {
+  if (isSlabPointer(ptr)) {
+    return slabOf(ptr)->objectSize;
+  }
+  Block* block = payloadBlock(ptr);
+  if (block->kind == KIND_BUDDY) {
+    return ((size_t)1 << ((BuddyBlock*)block)->order) - BUDDY_HEADER_SIZE;
+  }
+  return block->size;
+}
+
+// arena whose regions hold ptr; buddy headers keep arena at the same offset
+static Arena* owningArena(void* ptr) {
+  if (isSlabPointer(ptr)) {
+    return &arenas[slabOf(ptr)->arena];
+  }
+  return &arenas[payloadBlock(ptr)->arena];
+}
+
+// Link field for the remote-free stack: the first word of the payload,
+// which every block kind has room for.
+static void** remoteLink(void* ptr) {
+  return (void**)ptr;
+}
+
+// Lock-free multi-producer push onto the owner's remote-free stack.
+static void pushRemoteFree(Arena* owner, void* ptr) {
+  void** link = remoteLink(ptr);
+  void* head = __atomic_load_n(&owner->remoteFrees, __ATOMIC_RELAXED);
+  do {
+    *link = head;
+  } while (!__atomic_compare_exchange_n(&owner->remoteFrees, &head, ptr, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// The single consumer takes the whole stack at once. Caller holds arena->lock.
+static void drainRemoteFrees(Arena* arena) {
+  void* ptr = __atomic_exchange_n(&arena->remoteFrees, NULL, __ATOMIC_ACQUIRE);
+  while (ptr) {
+    void* next = *remoteLink(ptr);
+    releaseBlock(arena, ptr);
+    ptr = next;
+  }
+}
+
+// Hands every block in the cache back to arena. Caller holds arena->lock.
+static void emptyThreadCache(TCache* cache, Arena* arena) {
+  for (size_t bin = 1; bin < TCACHE_BINS; bin++) {
+    void* ptr;
+    while ((ptr = tcachePop(cache, bin)) != NULL) {
+      releaseBlock(arena, ptr);
+    }
+  }
+}
+
+// return every cached block to the heap when its thread exits
+static void flushThreadCache(void* arg) {
+  TCache* cache = (TCache*)arg;
+  Arena* arena = threadArena;
+  if (arena && cache->generation == heapGeneration) {
+    pthread_mutex_lock(&arena->lock);
+    emptyThreadCache(cache, arena);
+    pthread_mutex_unlock(&arena->lock);
+  }
+
+  pthread_mutex_lock(&cacheListLock);
+  if (cache->prevCache) cache->prevCache->nextCache = cache->nextCache;
+  else cacheList = cache->nextCache;
+  if (cache->nextCache) cache->nextCache->prevCache = cache->prevCache;
+  pthread_mutex_unlock(&cacheListLock);
+  memset(cache, 0, sizeof(TCache));
+  threadArena = NULL;
+}
+
+static void createCacheKey(void) {
+  pthread_key_create(&cacheKey, flushThreadCache);
+}
+
+// The calling thread's cache; also assigns the thread an arena on first use.
+static TCache* threadCache(void) {
+  TCache* cache = &threadCacheData;
+  if (!cache->registered) {
+    pthread_once(&cacheKeyOnce, createCacheKey);
+    pthread_setspecific(cacheKey, cache);
+    cache->registered = true;
+
+    pthread_mutex_lock(&cacheListLock);
+    cache->prevCache = NULL;
+    cache->nextCache = cacheList;
+    if (cacheList) cacheList->prevCache = cache;
+    cacheList = cache;
+    pthread_mutex_unlock(&cacheListLock);
+  }
+  if (cache->generation != heapGeneration || !threadArena) {
+    // blocks cached before the last t_init belong to an abandoned heap
+    tcacheLock(cache);
+    memset(cache->heads, 0, sizeof(cache->heads));
+    memset(cache->counts, 0, sizeof(cache->counts));
+    tcacheUnlock(cache);
+    cache->generation = heapGeneration;
+    unsigned index = __atomic_fetch_add(&nextArena, 1, __ATOMIC_RELAXED);
+    threadArena = &arenas[index % arenaCount];
+  }
+  return cache;
+}
+
+// True if ptr came straight from a free block that was still zero from
+// mmap; the few words the free structures wrote into it are cleared here.
+static bool takeZeroed(void* ptr) {
+  if (isSlabPointer(ptr)) return false;
+  Block* block = payloadBlock(ptr);
+  if (block->kind != KIND_HEAP || !(block->flags & BLOCK_ZEROED)) return false;
+
+  block->flags &= (uint8_t)~BLOCK_ZEROED;
+  memset(ptr, 0, sizeof(FreeBlock) - sizeof(Block));
+  *blockFooter(block) = 0;
+  return true;
+}
+
+// t_malloc; if zeroed is given, it reports whether the memory is known zero
+static void* mallocInternal(size_t size, bool* zeroed)
+{
+  TCache* cache = threadCache();
+  Arena* arena = threadArena;
+  size_t bin = tcacheRequestBin(size);
+
+  // large requests get a mapping of their own and never touch an arena
+  if (isLargeRequest(size)) {
+    if (zeroed) *zeroed = true;
+    return largeMalloc(size, arena->index);
+  }
+
+  // fast path: reuse a block this thread freed recently, no lock. Blocks
+  // other threads freed back to this arena are picked up first.
+  bool pending = __atomic_load_n(&arena->remoteFrees, __ATOMIC_RELAXED) != NULL;
+  if (bin && !pending) {
+    tcacheLock(cache);
+    void* ptr = tcachePop(cache, bin);
+    tcacheUnlock(cache);
+    if (ptr) return ptr;
+  }
+
+  pthread_mutex_lock(&arena->lock);
+  drainRemoteFrees(arena);
+  void* ptr = NULL;
+  // a cached block may have been written since it left the free structures,
+  // so only a block taken from them just now can be known zero
+  bool fresh = false;
+  if (bin) {
+    ptr = tcachePop(cache, bin);
+    // refill: allocate a batch of blocks for the bin under one lock
+    size_t binSize = bin * TCACHE_GRANULE;
+    if (!ptr) {
+      ptr = strategyMalloc(arena, binSize);
+      fresh = true;
+      for (int i = 1; ptr && i < TCACHE_BATCH; i++) {
+        void* extra = strategyMalloc(arena, binSize);
+        if (!extra) break;
+        tcachePush(cache, bin, extra);
+      }
+    }
+  } else {
+    ptr = strategyMalloc(arena, size);
+    fresh = true;
+  }
+  if (zeroed && fresh && ptr) *zeroed = takeZeroed(ptr);
+  pthread_mutex_unlock(&arena->lock);
+  return ptr;
+}
+
+// one relaxed load per call while no trace is being recorded
+static inline bool tracing(void) {
+  return __atomic_load_n(&traceActive, __ATOMIC_RELAXED);
+}
+
+void *
+t_malloc (size_t size)
+{
+  void* ptr = mallocInternal(size, NULL);
+  if (tracing()) traceAlloc(TRACE_MALLOC, ptr, size, 0);
+  return ptr;
+}
+
+void *
+t_calloc (size_t count, size_t size)
+{
+  if (size && count > SIZE_MAX / size) return NULL;
+  size_t total = count * size;
+
+  // memory fresh from an anonymous mapping is already zero
+  bool zeroed = false;
+  void* ptr = mallocInternal(total, &zeroed);
+  if (ptr && !zeroed) {
+    memset(ptr, 0, total);
+  }
+  if (tracing()) traceAlloc(TRACE_CALLOC, ptr, total, 0);
+  return ptr;
+}
+
+static void freeInternal(void* ptr) {
+  // directly mapped blocks go straight back to the kernel
+  if (!isSlabPointer(ptr) && payloadBlock(ptr)->kind == KIND_LARGE) {
+    largeFree(ptr);
+    return;
+  }
+
+  TCache* cache = threadCache();
+  Arena* arena = threadArena;
+  Arena* owner = owningArena(ptr);
+
+  // a block from another arena goes back to its owner without a lock
+  if (owner != arena) {
+    pushRemoteFree(owner, ptr);
+    return;
+  }
+
+  size_t bin = tcacheBlockBin(usableSize(ptr));
+
+  // fast path: keep the block for this thread's next allocation, no lock
+  if (bin) {
+    tcacheLock(cache);
+    bool kept = cache->counts[bin] < TCACHE_BIN_CAPACITY;
+    if (kept) tcachePush(cache, bin, ptr);
+    tcacheUnlock(cache);
+    if (kept) return;
+  }
+
+  pthread_mutex_lock(&arena->lock);
+  if (bin) {
+    // flush: hand a batch of the bin back to the heap under one lock
+    for (int i = 0; i < TCACHE_BATCH; i++) {
+      releaseBlock(arena, tcachePop(cache, bin));
+    }
+    tcachePush(cache, bin, ptr);
+  } else {
+    releaseBlock(arena, ptr);
+  }
+  pthread_mutex_unlock(&arena->lock);
+}
+
+void
+t_free (void *ptr) {
+  if (!ptr) return;
+  if (tracing()) traceFree(ptr);
+  freeInternal(ptr);
+}
+
+// Cuts a heap block down to size bytes, freeing the tail when it is big
+// enough to be a block. Caller holds the lock of the block's arena.
+static void shrinkBlock(Arena* arena, Block* block, size_t size) {
+  if (block->size < size + sizeof(Block) + MIN_PAYLOAD) return;
+
+  Block* rest = (Block*)((char*)block + sizeof(Block) + size);
+  rest->size = block->size - size - sizeof(Block);
+  rest->arena = block->arena;
+  rest->flags = 0;
+  rest->kind = KIND_HEAP;
+  block->size = size;
+  // rest is counted as allocated until it is freed
+  statAdd(&arena->stats.blocks, 1);
+  statSub(&arena->stats.allocated, sizeof(Block));
+  // freeing the tail merges it with a free successor and writes its tags
+  strategyFree(arena, blockPayload(rest));
+}
+
+// Resizes a heap block without moving it, growing into a free physical
+// successor if needed. Returns false if the successor is not free or too small.
+static bool resizeInPlace(void* ptr, size_t size) {
+  size_t need = requestPayload(size);
+  if (!need) return false;
+
+  Block* block = payloadBlock(ptr);
+  Arena* arena = &arenas[block->arena];
+  pthread_mutex_lock(&arena->lock);
+  if (need > block->size) {
+    Block* next = nextBlock(block);
+    if (!(next->flags & BLOCK_FREE) || block->size + sizeof(Block) + next->size < need) {
+      pthread_mutex_unlock(&arena->lock);
+      return false;
+    }
+    unindexFreeBlock(arena, (FreeBlock*)next);
+    block->size += sizeof(Block) + next->size;
+    nextBlock(block)->flags &= (uint8_t)~BLOCK_PREV_FREE;
+    statSub(&arena->stats.blocks, 1);
+    statAdd(&arena->stats.allocated, sizeof(Block) + next->size);
+  }
+  shrinkBlock(arena, block, need);
+  pthread_mutex_unlock(&arena->lock);
+  return true;
+}
+
+// *stamp is the time t_realloc traces the call at, read before ptr can be
+// released. Once the call holds a block at a new address while ptr is still
+// live it is read again, so a free of that address by another thread sorts
+// first; a plain allocation is stamped when it returns.
+static void* reallocInternal(void* ptr, size_t size, uint64_t* stamp) {
+  if (!ptr) {
+    *stamp = 0;
+    return mallocInternal(size, NULL);
+  }
+  if (size == 0) {
+    freeInternal(ptr);
+    return NULL;
+  }
+
+  if (isSlabPointer(ptr)) {
+    if (size <= slabOf(ptr)->objectSize) return ptr;
+  } else {
+    Block* block = payloadBlock(ptr);
+    if (block->kind == KIND_LARGE) {
+      // mremap grows or shrinks the mapping, moving it only if it must
+      return largeRealloc(ptr, size);
+    }
+    if (block->kind == KIND_HEAP && resizeInPlace(ptr, size)) return ptr;
+    if (block->kind == KIND_BUDDY && size <= usableSize(ptr)) return ptr;
+  }
+
+  // move: allocate, copy the smaller of the two sizes, free
+  size_t oldSize = usableSize(ptr);
+  void* newPtr = mallocInternal(size, NULL);
+  if (!newPtr) return NULL;
+  if (*stamp) *stamp = traceClock();
+  memcpy(newPtr, ptr, oldSize < size ? oldSize : size);
+  freeInternal(ptr);
+  return newPtr;
+}
+
+void *
+t_realloc (void *ptr, size_t size)
+{
+  // stamped before the old block is released, as t_free records first
+  uint64_t stamp = tracing() ? traceClock() : 0;
+  void* newPtr = reallocInternal(ptr, size, &stamp);
+  // a failed resize leaves the object as it was
+  if (tracing() && (newPtr || size == 0)) traceRealloc(ptr, newPtr, size, stamp);
+  return newPtr;
+}
+
+// Carves a block with an aligned payload out of a heap block that is big
+// enough for any lead-in. The lead-in and the unused tail go back to the
+// free lists as blocks of their own. Buddy blocks cannot be split at an
+// arbitrary offset, so under BUDDY the arena's first-fit heap is used.
+// Caller holds arena->lock.
+static void* alignedHeapMalloc(Arena* arena, size_t size, size_t alignment) {
+  // the smallest lead-in that can stand as a free block
+  size_t minLead = sizeof(Block) + MIN_PAYLOAD;
+  size_t need = requestPayload(size);
+  if (!need || need > SIZE_MAX / 2 - alignment - minLead) return NULL;
+
+  size_t padded = need + alignment + minLead;
+  void* ptr = arena->strategy == BUDDY ? firstFit(arena, padded) : heapMalloc(arena, padded);
+  if (!ptr) return NULL;
+
+  Block* block = payloadBlock(ptr);
+  uintptr_t addr = (uintptr_t)ptr;
+  uintptr_t aligned = (addr + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  if (aligned != addr) {
+    while (aligned - addr < minLead) {
+      aligned += alignment;
+    }
+    Block* alignedBlock = payloadBlock((void*)aligned);
+    alignedBlock->size = block->size - (aligned - addr);
+    alignedBlock->arena = block->arena;
+    alignedBlock->flags = 0;
+    alignedBlock->kind = KIND_HEAP;
+    alignedBlock->adaptClass = block->adaptClass;
+    block->size = aligned - addr - sizeof(Block);
+    statAdd(&arena->stats.blocks, 1);
+    statSub(&arena->stats.allocated, sizeof(Block));
+    // freeing the lead-in merges it with a free predecessor
+    strategyFree(arena, ptr);
+    block = alignedBlock;
+  }
+  shrinkBlock(arena, block, need);
+  return (void*)aligned;
+}
+
+static void* alignedInternal(size_t size, size_t alignment) {
+  // every block is already aligned this far
+  if (alignment <= ALIGNMENT) return mallocInternal(size, NULL);
+
+  threadCache();
+  Arena* arena = threadArena;
+  if (isLargeRequest(size)) {
+    return largeAlignedMalloc(size, alignment, arena->index);
+  }
+
+  pthread_mutex_lock(&arena->lock);
+  drainRemoteFrees(arena);
+  void* ptr = alignedHeapMalloc(arena, size, alignment);
+  pthread_mutex_unlock(&arena->lock);
+  return ptr;
+}
+
+void *
+t_aligned_alloc (size_t size, size_t alignment)
+{
+  if (alignment == 0 || (alignment & (alignment - 1))) return NULL;
+  void* ptr = alignedInternal(size, alignment);
+  if (tracing()) traceAlloc(TRACE_ALIGNED, ptr, size, (uint8_t)__builtin_ctzl(alignment));
+  return ptr;
+}
+
+size_t
+t_usable_size (void *ptr)
+{
+  return ptr ? usableSize(ptr) : 0;
+}
+
+int
+t_posix_memalign (void **memptr, size_t alignment, size_t size)
+{
+  if (alignment < sizeof(void*) || (alignment & (alignment - 1))) return EINVAL;
+  void* ptr = t_aligned_alloc(size, alignment);
+  if (!ptr) return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+void
+t_set_huge_pages (int enable)
+{
+  hugePagesEnable(enable != 0);
+}
+
+size_t
+t_huge_page_bytes (void)
+{
+  return hugePageBytes();
+}
+
+void
+t_set_mmap_threshold (size_t threshold)
+{
+  largeSetThreshold(threshold);
+}
+
+void
+t_set_trim_threshold (size_t threshold)
+{
+  __atomic_store_n(&trimThreshold, threshold, __ATOMIC_RELAXED);
+}
+
+// Releases the free memory of one arena's regions beyond *keep bytes.
+// Caller holds arena->lock.
+static size_t trimRegions(Arena* arena, size_t* keep) {
+  size_t released = 0;
+  Region* region = arena->regions.head;
+  while (region) {
+    Region* nextRegion = region->next;
+    Block* block = firstBlock(region);
+    if ((block->flags & BLOCK_FREE) && isSentinel(nextBlock(block))) {
+      if (region->size <= *keep) {
+        *keep -= region->size;
       } else {
-          blockList->tail = block;
+        released += region->size;
+        releaseRegion(arena, region);
+      }
+      region = nextRegion;
+      continue;
+    }
+
+    for (; !isSentinel(block); block = nextBlock(block)) {
+      if (!(block->flags & BLOCK_FREE)) continue;
+      uintptr_t start, end;
+      freeInterior(block, 0, &start, &end);
+      if (block->flags & BLOCK_TRIMMED) {
+        // only the resident pad at the front is left
+        uintptr_t padEnd, unused;
+        freeInterior(block, trimThreshold, &padEnd, &unused);
+        if (padEnd < end) end = padEnd;
+      }
+      if (end <= start) continue;
+      if (end - start <= *keep) {
+        *keep -= end - start;
+        continue;
       }
+      released += end - start;
+      statsCall(STAT_MADVISE);
+      madvise((void*)start, end - start, trimAdvice);
+      block->flags |= BLOCK_TRIMMED;
+    }
+    region = nextRegion;
+  }
+  return released;
+}
+
+int
+t_trim (size_t keep)
+{
+  // blocks parked in this thread's cache pin their pages; return them first
+  TCache* cache = threadCache();
+  Arena* own = threadArena;
+  pthread_mutex_lock(&own->lock);
+  emptyThreadCache(cache, own);
+  pthread_mutex_unlock(&own->lock);
+
+  size_t released = 0;
+  for (unsigned i = 0; i < arenaCount; i++) {
+    Arena* arena = &arenas[i];
+    pthread_mutex_lock(&arena->lock);
+    drainRemoteFrees(arena);
+    released += trimRegions(arena, &keep);
+    released += buddyTrim(&arena->buddy, &keep);
+    pthread_mutex_unlock(&arena->lock);
+  }
+  released += slabTrim(&keep);
+  return released > 0;
+}
+
+// Sweep callback for the collector; the arena locks are already held.
+static void collectBlock(void* ptr) {
+  // a collected object ends its life in the trace like a freed one
+  if (tracing()) traceFree(ptr);
+  if (!isSlabPointer(ptr) && payloadBlock(ptr)->kind == KIND_LARGE) {
+    largeFree(ptr);
+    return;
   }
+  releaseBlock(owningArena(ptr), ptr);
 }
 
 void
 t_gcollect (void)
 {
+  // every arena stays locked for the whole collection, and no heap can be
+  // destroyed while its blocks are scanned
+  pthread_mutex_lock(&heapsLock);
+  for (unsigned i = 0; i < arenaCount; i++) {
+    pthread_mutex_lock(&arenas[i].lock);
+    drainRemoteFrees(&arenas[i]);
+  }
 
-}
\ No newline at end of file
+  // cached blocks are free as far as their owners are concerned; hand them
+  // back so the sweep does not see them as unreachable allocations. Each
+  // cache is taken from its owner first, see tcacheLock.
+  pthread_mutex_lock(&cacheListLock);
+  for (TCache* cache = cacheList; cache; cache = cache->nextCache) {
+    tcacheLock(cache);
+    if (cache->generation == heapGeneration) {
+      for (size_t bin = 1; bin < TCACHE_BINS; bin++) {
+        void* ptr;
+        while ((ptr = tcachePop(cache, bin)) != NULL) {
+          releaseBlock(owningArena(ptr), ptr);
+        }
+      }
+    }
+    tcacheUnlock(cache);
+  }
+  pthread_mutex_unlock(&cacheListLock);
+
+  gcCollect(collectBlock, arenaCount);
+
+  for (unsigned i = arenaCount; i-- > 0;) {
+    pthread_mutex_unlock(&arenas[i].lock);
+  }
+  pthread_mutex_unlock(&heapsLock);
+}
+
+int
+t_trace_start (const char *path)
+{
+  return traceStart(path) ? 0 : -1;
+}
+
+void
+t_trace_stop (void)
+{
+  traceStop();
+}
+
+// Adds one kind of space to stats. Each block costs blockHeader bytes of
+// the space and each region regionHeader bytes outside it.
+static void addSpaceStats(struct t_stats* stats, const SpaceStats* space,
+                          size_t blockHeader, size_t regionHeader) {
+  size_t blocks = __atomic_load_n(&space->blocks, __ATOMIC_RELAXED);
+  size_t regions = __atomic_load_n(&space->regions, __ATOMIC_RELAXED);
+  stats->heap_bytes += __atomic_load_n(&space->space, __ATOMIC_RELAXED) - blocks * blockHeader;
+  stats->allocated_bytes += __atomic_load_n(&space->allocated, __ATOMIC_RELAXED);
+  stats->block_count += blocks;
+  stats->overhead_bytes += regions * regionHeader + blocks * blockHeader;
+}
+
+void
+t_stats (struct t_stats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  unsigned count = __atomic_load_n(&arenaCount, __ATOMIC_RELAXED);
+  for (unsigned i = 0; i < count; i++) {
+    Arena* arena = &arenas[i];
+    // a heap region's header and end sentinel lie outside its space
+    addSpaceStats(stats, &arena->stats, sizeof(Block), sizeof(Region) + sizeof(Block));
+    addSpaceStats(stats, &arena->buddy.stats, BUDDY_HEADER_SIZE, BUDDY_REGION_HEADER);
+    addSpaceStats(stats, &arena->slabs.stats, 0, SLAB_HEADER_SIZE);
+    stats->region_count += __atomic_load_n(&arena->stats.regions, __ATOMIC_RELAXED)
+                         + __atomic_load_n(&arena->buddy.stats.regions, __ATOMIC_RELAXED);
+  }
+  SpaceStats large;
+  largeStats(&large);
+  addSpaceStats(stats, &large, sizeof(Block), 0);
+  stats->mapped_bytes = statsMappedBytes();
+  stats->peak_mapped_bytes = statsPeakMappedBytes();
+  stats->huge_page_bytes = hugePageBytes();
+  stats->mmap_calls = statsCalls(STAT_MMAP);
+  stats->munmap_calls = statsCalls(STAT_MUNMAP);
+  stats->mremap_calls = statsCalls(STAT_MREMAP);
+  stats->madvise_calls = statsCalls(STAT_MADVISE);
+  stats->mprotect_calls = statsCalls(STAT_MPROTECT);
+}
+
+void
+t_frag_stats (struct t_frag *frag)
+{
+  memset(frag, 0, sizeof(*frag));
+  for (unsigned i = 0; i < arenaCount; i++) {
+    Arena* arena = &arenas[i];
+    pthread_mutex_lock(&arena->lock);
+    for (unsigned bin = 0; bin < FREE_BINS; bin++) {
+      frag->free_blocks[bin] += arena->freeBins[bin];
+      frag->free_block_count += arena->freeBins[bin];
+    }
+    frag->free_bytes += arena->freeBytes;
+    FreeBlock* largest = maxSizeTree(&arena->sizeTree);
+    if (largest && largest->header.size > frag->largest_free) {
+      frag->largest_free = largest->header.size;
+    }
+
+    // buddy blocks are binned by their payload, 2^order less the header
+    BuddyHeap* buddy = &arena->buddy;
+    for (int order = BUDDY_MIN_ORDER; order <= BUDDY_MAX_ORDER; order++) {
+      size_t count = buddy->freeCounts[order];
+      size_t payload = ((size_t)1 << order) - BUDDY_HEADER_SIZE;
+      frag->free_blocks[freeBin(payload)] += count;
+      frag->free_block_count += count;
+      frag->free_bytes += count * payload;
+    }
+    if (buddy->orderBitmap) {
+      int order = 63 - __builtin_clzll(buddy->orderBitmap);
+      size_t payload = ((size_t)1 << order) - BUDDY_HEADER_SIZE;
+      if (payload > frag->largest_free) frag->largest_free = payload;
+    }
+    pthread_mutex_unlock(&arena->lock);
+  }
+  if (frag->free_bytes > 0) {
+    frag->fragmentation = 1.0 - (double)frag->largest_free / (double)frag->free_bytes;
+  }
+}
+
+void
+t_adaptive_stats (struct t_adaptive *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  unsigned costRuns[ADAPT_CLASSES][ADAPT_POLICIES] = {{0}};
+  for (unsigned i = 0; i < arenaCount; i++) {
+    Arena* arena = &arenas[i];
+    pthread_mutex_lock(&arena->lock);
+    for (unsigned cls = 0; cls < ADAPT_CLASSES && cls < T_ADAPT_CLASSES; cls++) {
+      AdaptClass* c = &arena->adapt.classes[cls];
+      struct t_adapt_class* out = &stats->classes[cls];
+      out->allocs += c->allocs;
+      out->frees += c->frees;
+      out->epochs += c->epochs;
+      out->switches += c->switches;
+      stats->switches += c->switches;
+      if (c->allocs == 0) continue;
+      out->arenas[c->policy]++;
+      for (unsigned p = 0; p < ADAPT_POLICIES; p++) {
+        if (c->cost[p] >= 0) {
+          out->cost[p] += c->cost[p];
+          costRuns[cls][p]++;
+        }
+      }
+    }
+    pthread_mutex_unlock(&arena->lock);
+  }
+  for (unsigned cls = 0; cls < ADAPT_CLASSES && cls < T_ADAPT_CLASSES; cls++) {
+    for (unsigned p = 0; p < ADAPT_POLICIES; p++) {
+      struct t_adapt_class* out = &stats->classes[cls];
+      out->cost[p] = costRuns[cls][p] ? out->cost[p] / costRuns[cls][p] : -1;
+    }
+  }
+}
+
+static int compareDecision(const void* a, const void* b) {
+  unsigned long long x = ((const struct t_adapt_decision*)a)->sequence;
+  unsigned long long y = ((const struct t_adapt_decision*)b)->sequence;
+  return (x > y) - (x < y);
+}
+
+size_t
+t_adaptive_decisions (struct t_adapt_decision *log, size_t max)
+{
+  size_t count = 0;
+  if (max == 0) return 0;
+  for (unsigned i = 0; i < arenaCount; i++) {
+    Arena* arena = &arenas[i];
+    pthread_mutex_lock(&arena->lock);
+    AdaptState* state = &arena->adapt;
+    size_t kept = state->logged < ADAPT_LOG ? state->logged : ADAPT_LOG;
+    for (size_t k = 0; k < kept; k++) {
+      AdaptDecision* d = &state->log[k];
+      // once log is full, a newer decision takes the oldest one's place
+      size_t at = count;
+      if (count == max) {
+        at = 0;
+        for (size_t j = 1; j < max; j++) {
+          if (log[j].sequence < log[at].sequence) at = j;
+        }
+        if (log[at].sequence > d->sequence) continue;
+      } else {
+        count++;
+      }
+      log[at].sequence = d->sequence;
+      log[at].arena = i;
+      log[at].size_class = d->sizeClass;
+      log[at].from = (alloc_strat_e)d->from;
+      log[at].to = (alloc_strat_e)d->to;
+      log[at].from_cost = d->fromCost;
+      log[at].to_cost = d->toCost;
+    }
+    pthread_mutex_unlock(&arena->lock);
+  }
+  qsort(log, count, sizeof(*log), compareDecision);
+  return count;
+}
+
+// Fills info from one pass over the region's blocks in address order.
+// Caller holds the lock of the region's arena.
+static void describeRegion(Region* region, struct t_region_info* info) {
+  memset(info, 0, sizeof(*info));
+  info->base = region;
+  info->size = region->size;
+  info->arena = region->arena;
+  for (Block* block = firstBlock(region); !isSentinel(block); block = nextBlock(block)) {
+    info->blocks++;
+    if (block->flags & BLOCK_FREE) {
+      info->free_blocks++;
+      info->free_bytes += block->size;
+      if (block->size > info->largest_free) info->largest_free = block->size;
+    } else {
+      info->allocated_bytes += block->size;
+    }
+  }
+}
+
+size_t
+t_heap_regions (struct t_region_info *info, size_t max)
+{
+  size_t count = 0;
+  for (unsigned i = 0; i < arenaCount; i++) {
+    Arena* arena = &arenas[i];
+    pthread_mutex_lock(&arena->lock);
+    for (Region* region = arena->regions.head; region; region = region->next) {
+      if (count < max) describeRegion(region, &info[count]);
+      count++;
+    }
+    pthread_mutex_unlock(&arena->lock);
+  }
+  return count;
+}
+
+// Heap map output. Formatting goes through a fixed buffer and write(), not
+// stdio, since stdio may allocate and the arena lock is held meanwhile.
+#define MAP_GRANULE REGION_GRANULE  // bytes per map character
+
+typedef struct MapWriter {
+  int fd;
+  bool failed;
+  size_t used;              // bytes in buf
+  uintptr_t granuleEnd;     // end of the granule being measured
+  size_t granuleAllocated;  // its allocated bytes so far
+  char buf[4096];
+} MapWriter;
+
+static void mapFlush(MapWriter* w) {
+  size_t done = 0;
+  while (!w->failed && done < w->used) {
+    ssize_t n = write(w->fd, w->buf + done, w->used - done);
+    if (n <= 0) w->failed = true;
+    else done += (size_t)n;
+  }
+  w->used = 0;
+}
+
+static void mapPut(MapWriter* w, const char* data, size_t len) {
+  while (len > 0) {
+    if (w->used == sizeof(w->buf)) mapFlush(w);
+    size_t n = sizeof(w->buf) - w->used;
+    if (n > len) n = len;
+    memcpy(w->buf + w->used, data, n);
+    w->used += n;
+    data += n;
+    len -= n;
+  }
+}
+
+// Accounts [start, end) to the granules it covers, writing one character
+// for each granule it completes: '.' free, '1'-'9' partly and '#' wholly
+// allocated. Headers, sentinels and allocated blocks count as allocated.
+static void mapSpan(MapWriter* w, uintptr_t start, uintptr_t end, bool allocated) {
+  while (start < end) {
+    uintptr_t stop = end < w->granuleEnd ? end : w->granuleEnd;
+    if (allocated) w->granuleAllocated += stop - start;
+    start = stop;
+    if (start == w->granuleEnd) {
+      char c = '.';
+      if (w->granuleAllocated == MAP_GRANULE) c = '#';
+      else if (w->granuleAllocated > 0) c = (char)('1' + w->granuleAllocated * 9 / MAP_GRANULE);
+      mapPut(w, &c, 1);
+      w->granuleEnd += MAP_GRANULE;
+      w->granuleAllocated = 0;
+    }
+  }
+}
+
+int
+t_heap_map (const char *path)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return -1;
+
+  MapWriter w;
+  w.fd = fd;
+  w.failed = false;
+  w.used = 0;
+  char line[160];
+  int len = snprintf(line, sizeof(line),
+                     "# tdmm heap map: %d bytes per character, '.' free, '1'-'9' partly allocated, '#' allocated\n",
+                     MAP_GRANULE);
+  mapPut(&w, line, (size_t)len);
+
+  for (unsigned i = 0; i < arenaCount; i++) {
+    Arena* arena = &arenas[i];
+    pthread_mutex_lock(&arena->lock);
+    for (Region* region = arena->regions.head; region; region = region->next) {
+      struct t_region_info info;
+      describeRegion(region, &info);
+      len = snprintf(line, sizeof(line), "region arena=%u base=%p size=%zu allocated=%zu free=%zu blocks=%zu largest_free=%zu\n",
+                     info.arena, info.base, info.size, info.allocated_bytes, info.free_bytes,
+                     info.blocks, info.largest_free);
+      mapPut(&w, line, (size_t)len);
+
+      uintptr_t base = (uintptr_t)region;
+      w.granuleEnd = base + MAP_GRANULE;
+      w.granuleAllocated = 0;
+      Block* block = firstBlock(region);
+      mapSpan(&w, base, (uintptr_t)block, true);
+      for (; !isSentinel(block); block = nextBlock(block)) {
+        mapSpan(&w, (uintptr_t)block, (uintptr_t)nextBlock(block), !(block->flags & BLOCK_FREE));
+      }
+      // the sentinel closes the region, which is a whole number of granules
+      mapSpan(&w, (uintptr_t)block, base + region->size, true);
+      mapPut(&w, "\n", 1);
+    }
+    mapFlush(&w);
+    pthread_mutex_unlock(&arena->lock);
+  }
+  mapFlush(&w);
+  if (close(fd) != 0) w.failed = true;
+  return w.failed ? -1 : 0;
+}
+
+// Finds count free arena slots in a row above the default heap's; returns
+// the first, or 0 if there are none. Caller holds heapsLock.
+static unsigned takeArenas(unsigned count) {
+  unsigned run = 0;
+  for (unsigned i = arenaCount; i < MAX_ARENAS; i++) {
+    run = arenaTaken[i] ? 0 : run + 1;
+    if (run == count) {
+      unsigned first = i + 1 - count;
+      for (unsigned j = first; j <= i; j++) {
+        arenaTaken[j] = true;
+      }
+      return first;
+    }
+  }
+  return 0;
+}
+
+struct t_heap *
+t_heap_create (alloc_strat_e strategy, const struct t_heap_opts *opts)
+{
+  unsigned count = opts && opts->arenas ? opts->arenas : 1;
+  if (count > MAX_HEAP_ARENAS) count = MAX_HEAP_ARENAS;
+
+  pthread_mutex_lock(&heapsLock);
+  struct t_heap* heap = NULL;
+  for (unsigned h = 1; h < MAX_HEAPS; h++) {
+    if (!heaps[h].live) {
+      heap = &heaps[h];
+      break;
+    }
+  }
+  unsigned first = heap ? takeArenas(count) : 0;
+  if (!first) {
+    pthread_mutex_unlock(&heapsLock);
+    return NULL;
+  }
+  for (unsigned i = first; i < first + count; i++) {
+    initArena(&arenas[i], i, strategy, true);
+  }
+  heap->first = first;
+  heap->count = count;
+  heap->live = true;
+  pthread_mutex_unlock(&heapsLock);
+  return heap;
+}
+
+struct t_heap *
+t_heap_default (void)
+{
+  return &heaps[0];
+}
+
+// the calling thread's arena in an isolated heap
+static Arena* heapArena(struct t_heap* heap) {
+  if (heap->count == 1) return &arenas[heap->first];
+  if (!heapThread) {
+    heapThread = __atomic_add_fetch(&nextHeapThread, 1, __ATOMIC_RELAXED);
+  }
+  return &arenas[heap->first + heapThread % heap->count];
+}
+
+void *
+t_heap_malloc (struct t_heap *heap, size_t size)
+{
+  if (heap == &heaps[0]) return t_malloc(size);
+  if (!heap->live) return NULL;
+
+  Arena* arena = heapArena(heap);
+  pthread_mutex_lock(&arena->lock);
+  drainRemoteFrees(arena);
+  void* ptr = strategyMalloc(arena, size);
+  pthread_mutex_unlock(&arena->lock);
+  if (tracing()) traceAlloc(TRACE_MALLOC, ptr, size, 0);
+  return ptr;
+}
+
+void
+t_heap_free (struct t_heap *heap, void *ptr)
+{
+  if (!ptr) return;
+  if (heap == &heaps[0]) {
+    t_free(ptr);
+    return;
+  }
+  if (tracing()) traceFree(ptr);
+
+  // any thread may free; the block goes straight back to its own arena
+  Arena* arena = owningArena(ptr);
+  pthread_mutex_lock(&arena->lock);
+  releaseBlock(arena, ptr);
+  pthread_mutex_unlock(&arena->lock);
+}
+
+// Unmaps every region of the arena, allocated blocks and all. Caller holds
+// heapsLock and the arena's lock.
+static void releaseArena(Arena* arena) {
+  Region* region = arena->regions.head;
+  while (region) {
+    Region* next = region->next;
+    regionTableRemove(region);
+    if (unmapRegion(region, region->size, region->huge) != 0) {
+      perror("munmap in releaseArena failed");
+    }
+    region = next;
+  }
+  initRegionList(&arena->regions);
+  releaseFreeLists(&arena->freeLists);
+  buddyRelease(&arena->buddy);
+  // blocks other threads freed back are gone with their regions
+  __atomic_store_n(&arena->remoteFrees, NULL, __ATOMIC_RELAXED);
+}
+
+void
+t_heap_destroy (struct t_heap *heap)
+{
+  if (!heap || heap == &heaps[0]) return;
+
+  pthread_mutex_lock(&heapsLock);
+  if (heap->live) {
+    for (unsigned i = heap->first; i < heap->first + heap->count; i++) {
+      pthread_mutex_lock(&arenas[i].lock);
+      releaseArena(&arenas[i]);
+      pthread_mutex_unlock(&arenas[i].lock);
+      arenaTaken[i] = false;
+    }
+    heap->live = false;
+  }
+  pthread_mutex_unlock(&heapsLock);
+}
+
+struct t_arena *
+t_arena_create (size_t chunk_size)
+{
+  return bumpCreate(chunk_size);
+}
+
+void *
+t_arena_alloc (struct t_arena *arena, size_t size)
+{
+  if (size > SIZE_MAX / 2) return NULL;
+  return bumpAlloc(arena, size);
+}
+
+struct t_arena_mark
+t_arena_mark (struct t_arena *arena)
+{
+  struct t_arena_mark mark = { arena->current, arena->top };
+  return mark;
+}
+
+void
+t_arena_reset (struct t_arena *arena, struct t_arena_mark mark)
+{
+  bumpReset(arena, (BumpChunk*)mark.chunk, (char*)mark.top);
+}
+
+void
+t_arena_destroy (struct t_arena *arena)
+{
+  bumpDestroy(arena);
+}
@@ -10,11 +10,145 @@ typedef enum
   WORST_FIT,
   BUDDY,
   SEQUENTIAL,
-  RANDOM
+  RANDOM,
+  ADAPTIVE
 } alloc_strat_e;
 
 /**
- * Initializes the memory allocator with the given strategy.
+ * Allocator counters, filled in by t_stats. The heap figures cover every
+ * block of the default heap: heap-region and buddy blocks, slab objects and
+ * directly mapped large blocks. Mapped bytes and system call
+ * counts are for the whole process and carry over across t_init, which
+ * leaves the previous heap mapped.
+ */
+struct t_stats
+{
+  size_t heap_bytes;        /* payload bytes of blocks, free or allocated */
+  size_t allocated_bytes;   /* payload bytes of allocated blocks */
+  size_t block_count;       /* heap, buddy and large blocks and slab objects, free or allocated */
+  size_t region_count;      /* heap and buddy regions */
+  size_t overhead_bytes;    /* region and slab headers, sentinels and block headers */
+  size_t mapped_bytes;      /* memory mapped for blocks of any kind */
+  size_t peak_mapped_bytes; /* the most mapped_bytes has been */
+  size_t huge_page_bytes;   /* as t_huge_page_bytes */
+  size_t mmap_calls;
+  size_t munmap_calls;
+  size_t mremap_calls;
+  size_t madvise_calls;
+  size_t mprotect_calls;
+};
+
+#define T_FRAG_BINS 64
+
+/**
+ * Free-space figures, filled in by t_frag_stats. They cover the free blocks
+ * of the heap regions and of the buddy heap; free slab objects and blocks
+ * held in thread caches count as allocated.
+ */
+struct t_frag
+{
+  size_t free_blocks[T_FRAG_BINS]; /* free blocks of i <= log2(size) < i + 1 */
+  size_t free_block_count;
+  size_t free_bytes;
+  size_t largest_free;             /* payload bytes of the largest free block */
+  double fragmentation;            /* 1 - largest_free / free_bytes, 0 if nothing is free */
+};
+
+/**
+ * One heap region, as filled in by t_heap_regions.
+ */
+struct t_region_info
+{
+  void *base;
+  size_t size;                     /* bytes mapped, headers included */
+  unsigned arena;
+  size_t blocks;
+  size_t free_blocks;
+  size_t allocated_bytes;
+  size_t free_bytes;
+  size_t largest_free;
+};
+
+#define T_ADAPT_CLASSES 32
+
+/**
+ * How ADAPTIVE places one request size class, as filled in by
+ * t_adaptive_stats. Class i holds heap requests of 2^i up to 2^(i+1) - 1
+ * bytes, the last class everything larger; small requests served from
+ * slabs never reach the heap and are not counted. Each arena learns its
+ * own policy per class; policies are indexed FIRST_FIT, BEST_FIT, WORST_FIT.
+ */
+struct t_adapt_class
+{
+  size_t allocs;                   /* heap allocations */
+  size_t frees;                    /* heap blocks allocated in this class and freed */
+  size_t epochs;                   /* decisions taken, one per 256 allocations */
+  size_t switches;                 /* times an arena changed the class's policy */
+  unsigned arenas[3];              /* arenas settled on each policy */
+  double cost[3];                  /* ns per allocation charged to each policy, averaged
+                                      over the arenas that ran it; -1 if none has */
+};
+
+struct t_adaptive
+{
+  struct t_adapt_class classes[T_ADAPT_CLASSES];
+  size_t switches;                 /* over all classes */
+};
+
+/**
+ * One change of policy, as filled in by t_adaptive_decisions. The cost of
+ * an allocation is the sampled time it took plus heap growth and any rise
+ * in fragmentation during the epoch, charged at the cost of faulting in
+ * the pages.
+ */
+struct t_adapt_decision
+{
+  unsigned long long sequence;     /* orders decisions across arenas */
+  unsigned arena;
+  unsigned size_class;
+  alloc_strat_e from;
+  alloc_strat_e to;
+  double from_cost;                /* ns per allocation */
+  double to_cost;
+};
+
+/**
+ * A heap of its own, made by t_heap_create. The t_* functions allocate
+ * from the default heap, which t_heap_default returns.
+ */
+struct t_heap;
+
+/**
+ * Options for t_heap_create; a NULL pointer takes the defaults.
+ */
+struct t_heap_opts
+{
+  unsigned arenas;                 /* arenas to spread threads over, 0 for one */
+};
+
+/**
+ * A bump arena, made by t_arena_create, for objects that die together.
+ */
+struct t_arena;
+
+/**
+ * A point in a bump arena's allocations, as returned by t_arena_mark. A
+ * zeroed mark is the arena's start.
+ */
+struct t_arena_mark
+{
+  void *chunk;
+  void *top;
+};
+
+/**
+ * Initializes the memory allocator with the given strategy, discarding any
+ * heaps made with t_heap_create. The default heap is split into one arena
+ * per online CPU, or TDMM_ARENAS arenas if that environment variable is
+ * set; threads are assigned arenas round-robin.
+ * ADAPTIVE starts every size class on first fit and moves it to best or
+ * worst fit when the time per allocation, heap growth and fragmentation
+ * trend it observes make that measurably cheaper; see t_adaptive_stats.
  * @param strat The strategy to use for memory allocation.
  */
 void t_init (alloc_strat_e strat);
@@ -27,6 +161,57 @@ void t_init (alloc_strat_e strat);
  */
 void *t_malloc (size_t size);
 
+/**
+ * Allocates zeroed memory for an array of count elements of size bytes.
+ * Memory that comes fresh from an anonymous mapping is not cleared again.
+ * @param count The number of elements.
+ * @param size The size of each element.
+ * @return A pointer to the zeroed memory, or NULL if the allocation fails
+ * or count * size overflows.
+ */
+void *t_calloc (size_t count, size_t size);
+
+/**
+ * Resizes the given memory block, keeping its contents up to the smaller
+ * of the old and new sizes. Heap blocks grow in place into a free
+ * neighbour and shrink in place; directly mapped blocks use mremap.
+ * @param ptr The block to resize, or NULL to allocate a new one.
+ * @param size The new size; 0 frees ptr and returns NULL.
+ * @return A pointer to the resized block, which may differ from ptr, or
+ * NULL if the resize fails (ptr is then left unchanged).
+ */
+void *t_realloc (void *ptr, size_t size);
+
+/**
+ * Allocates a block whose address is a multiple of alignment, e.g. 64 for
+ * a cache line or 4096 for a page. The block is carved out of a larger free
+ * block and the bytes before and after it go back to the heap, so only the
+ * header and a rounding remainder are spent on the alignment.
+ * @param size The size of the memory block to allocate.
+ * @param alignment A power of two.
+ * @return A pointer to the aligned block, or NULL if alignment is not a
+ * power of two or the allocation fails. Free it with t_free.
+ */
+void *t_aligned_alloc (size_t size, size_t alignment);
+
+/**
+ * posix_memalign for tdmm: allocates size bytes aligned to alignment.
+ * @param memptr Receives the block; left unchanged on failure.
+ * @param alignment A power of two and a multiple of sizeof(void *).
+ * @param size The size of the memory block to allocate.
+ * @return 0 on success, EINVAL for a bad alignment, ENOMEM if the
+ * allocation fails.
+ */
+int t_posix_memalign (void **memptr, size_t alignment, size_t size);
+
+/**
+ * Returns how many bytes may be used at ptr, which is at least the size
+ * it was allocated with.
+ * @param ptr A pointer returned by tdmm, or NULL.
+ * @return The usable size, or 0 for NULL.
+ */
+size_t t_usable_size (void *ptr);
+
 /**
  * Frees the given memory block.
  * @param ptr The pointer to the memory block to free. This must be a
@@ -35,9 +220,219 @@ void *t_malloc (size_t size);
 void t_free (void *ptr);
 
 /**
- * Performs basic garbage collection by scanning the stack and heap managed
- * by t_malloc and t_free.
+ * Sets the size at or above which t_malloc maps a block directly with mmap
+ * and t_free unmaps it right away. By default the threshold starts at
+ * 128 KiB (or TDMM_MMAP_THRESHOLD) and rises to the size of freed mapped
+ * blocks, up to 32 MiB; setting it explicitly turns that adaptation off.
+ * @param threshold The new threshold in bytes.
+ */
+void t_set_mmap_threshold (size_t threshold);
+
+/**
+ * Turns huge-page backed heap regions on or off for regions mapped from now
+ * on; TDMM_HUGEPAGES=1 turns them on at t_init. Regions are then sized in
+ * 2 MiB steps and mapped with MAP_HUGETLB, or 2 MiB-aligned and advised
+ * with MADV_HUGEPAGE when no hugetlb pages are available. Buddy regions and
+ * directly mapped blocks are not affected.
+ * @param enable Nonzero to use huge pages.
+ */
+void t_set_huge_pages (int enable);
+
+/**
+ * Reports the bytes of live heap regions mapped on hugetlb pages or advised
+ * for transparent huge pages. For the latter the kernel decides whether
+ * huge pages actually back them; see AnonHugePages in /proc/self/smaps.
+ * @return The number of bytes.
+ */
+size_t t_huge_page_bytes (void);
+
+/**
+ * Sets the size at or above which a free heap block hands the pages inside
+ * it back to the kernel with madvise as soon as it forms. The first
+ * threshold bytes of the block stay resident, since the next allocations
+ * are carved from there. The default is 128 KiB, or TDMM_TRIM_THRESHOLD;
+ * with TDMM_TRIM_LAZY set, MADV_FREE is used instead of MADV_DONTNEED.
+ * Regions that become entirely free are unmapped, except an arena's newest
+ * one. SIZE_MAX turns interior release off.
+ * @param threshold The new threshold in bytes.
+ */
+void t_set_trim_threshold (size_t threshold);
+
+/**
+ * Returns free memory to the kernel: entirely free regions are unmapped,
+ * the interior pages of other free blocks and the pages of unused slabs
+ * are released. The calling thread's cached blocks are freed first.
+ * @param keep Bytes of free memory to leave mapped and resident, taken from
+ * the first free spans found.
+ * @return 1 if any memory was released, 0 otherwise.
+ */
+int t_trim (size_t keep);
+
+/**
+ * Frees every block that is no longer reachable. The collector is
+ * conservative: any aligned word that points into a block's payload keeps
+ * the block alive. Roots are the calling thread's stack and registers,
+ * the data and bss segments of the program and its libraries, and the
+ * blocks of t_heap_create heaps and bump arenas. Other
+ * threads' stacks and thread-local storage are not scanned, so no other
+ * thread may hold heap pointers only there, or use the heap, during the call.
  */
 void t_gcollect (void);
 
+/**
+ * Starts recording every allocation, resize and free to a binary trace
+ * file, for replay with tdmm_replay. Each thread buffers its events
+ * without taking a shared lock and writes them out in chunks. Setting
+ * TDMM_TRACE to a path starts a trace at t_init that is written out at
+ * exit. Frees of blocks allocated before the trace started are dropped on
+ * replay.
+ * @param path The file to write; it is replaced if it exists.
+ * @return 0 on success, -1 if a trace is already running or the file
+ * cannot be created.
+ */
+int t_trace_start (const char *path);
+
+/**
+ * Writes out every thread's buffered events and closes the trace.
+ */
+void t_trace_stop (void);
+
+/**
+ * Copies the allocator's counters, which are kept up to date as blocks are
+ * split, merged, handed out and freed, so the call takes constant time and
+ * no lock. With other threads allocating, the figures are each current but
+ * may not be from quite the same moment.
+ * @param stats Where to store the counters.
+ */
+void t_stats (struct t_stats *stats);
+
+/**
+ * Reports how the free space is spread out. The histogram and byte counts
+ * are kept up to date as blocks are freed and taken, so the cost does not
+ * grow with the heap; each arena is locked briefly.
+ * @param frag Where to store the figures.
+ */
+void t_frag_stats (struct t_frag *frag);
+
+/**
+ * Describes the heap regions of every arena, from one pass over each
+ * region's blocks in address order.
+ * @param info Array to fill in.
+ * @param max Entries info has room for.
+ * @return The number of regions, which may be more than max.
+ */
+size_t t_heap_regions (struct t_region_info *info, size_t max);
+
+/**
+ * Writes a text map of the heap regions for offline viewing: a line of
+ * figures per region, then one character per 4 KiB, '.' for free, '1' to
+ * '9' for partly allocated and '#' for allocated.
+ * @param path The file to write; it is replaced if it exists.
+ * @return 0 on success, -1 if the file cannot be written.
+ */
+int t_heap_map (const char *path);
+
+/**
+ * Reports what the ADAPTIVE strategy has observed and decided for each
+ * size class since t_init. Each arena is locked briefly. All zero under
+ * other strategies.
+ * @param stats Where to store the figures.
+ */
+void t_adaptive_stats (struct t_adaptive *stats);
+
+/**
+ * Copies the latest ADAPTIVE policy switches, oldest first. Each arena
+ * remembers its last 32.
+ * @param log Array to fill in.
+ * @param max Entries log has room for.
+ * @return The number of entries filled in.
+ */
+size_t t_adaptive_decisions (struct t_adapt_decision *log, size_t max);
+
+/**
+ * Creates a heap of its own, for one tenant or session. Its blocks live in
+ * regions only it uses, small and large requests alike, so t_heap_destroy
+ * can hand them all back with one munmap per region. The heap is not
+ * covered by t_stats and the other reports, and t_gcollect does not
+ * collect its blocks, though it scans them for pointers.
+ * @param strategy The strategy the heap allocates with.
+ * @param opts Options, or NULL.
+ * @return The heap, or NULL if too many heaps or arenas exist.
+ */
+struct t_heap *t_heap_create (alloc_strat_e strategy, const struct t_heap_opts *opts);
+
+/**
+ * Returns the default heap, which t_malloc and the other t_* functions
+ * use. t_heap_malloc and t_heap_free on it are t_malloc and t_free.
+ * @return The default heap.
+ */
+struct t_heap *t_heap_default (void);
+
+/**
+ * Allocates a block of memory of the given size from heap.
+ * @param heap The heap to allocate from.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the block, or NULL if the allocation fails or the
+ * heap has been destroyed.
+ */
+void *t_heap_malloc (struct t_heap *heap, size_t size);
+
+/**
+ * Frees a block allocated from heap. Any thread may free any block.
+ * @param heap The heap the block was allocated from.
+ * @param ptr The block, or NULL.
+ */
+void t_heap_free (struct t_heap *heap, void *ptr);
+
+/**
+ * Destroys heap, unmapping all of its memory without visiting its blocks:
+ * every block allocated from it is freed at once. No other thread may use
+ * the heap during or after the call. The default heap cannot be destroyed.
+ * @param heap The heap to destroy.
+ */
+void t_heap_destroy (struct t_heap *heap);
+
+/**
+ * Creates a bump arena: allocation moves a pointer through a mapped chunk,
+ * and objects are only ever freed together, by t_arena_reset or
+ * t_arena_destroy. When a chunk fills, another is mapped and chained to
+ * it. An arena may only be used by one thread at a time, and must be
+ * destroyed before the next t_init. t_gcollect scans arenas for pointers.
+ * @param chunk_size Bytes per chunk, or 0 for 64 KiB. A larger request gets
+ * a chunk of its own size.
+ * @return The arena, or NULL if it cannot be mapped.
+ */
+struct t_arena *t_arena_create (size_t chunk_size);
+
+/**
+ * Allocates size bytes from the arena, aligned like t_malloc. While the
+ * current chunk has room this is a compare and an add.
+ * @param arena The arena to allocate from.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the block, or NULL if a new chunk cannot be mapped.
+ */
+void *t_arena_alloc (struct t_arena *arena, size_t size);
+
+/**
+ * Records the arena's current position for t_arena_reset.
+ * @param arena The arena.
+ * @return The mark.
+ */
+struct t_arena_mark t_arena_mark (struct t_arena *arena);
+
+/**
+ * Frees everything allocated since mark in O(1). The chunks mapped since
+ * stay chained and are reused by later allocations; marks taken after
+ * mark become invalid.
+ * @param arena The arena.
+ * @param mark A mark of this arena, or a zeroed one to free everything.
+ */
+void t_arena_reset (struct t_arena *arena, struct t_arena_mark mark);
+
+/**
+ * Unmaps every chunk of the arena, freeing all of its objects at once.
+ * @param arena The arena to destroy.
+ */
+void t_arena_destroy (struct t_arena *arena);
+
 #endif // TDMM_H_
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+bool traceActive = false;
+
+// One thread's pending records, written out as a chunk when full. Buffers
+// are mapped directly, never taken from the heap being traced, and stay on
+// a list so traceStop can write every thread's tail; a thread that exits
+// leaves its buffer for the next new thread.
+typedef struct TraceBuffer {
+    TraceChunkHeader chunk;
+    TraceRecord records[TRACE_BUFFER_RECORDS];
+    uint64_t last;              // time of the thread's previous record
+    unsigned generation;        // trace the chunk belongs to
+    bool busy;                  // held by whoever is using the records, see lockBuffer
+    bool inUse;
+    struct TraceBuffer* next;
+} TraceBuffer;
+
+// Events are recorded without any shared lock: each thread appends to its
+// own buffer and reserves room in the file for a full chunk with one
+// atomic add. traceLock only orders traceStart and traceStop and guards
+// the list of buffers, which a thread joins on its first event.
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t bufferKey;
+static pthread_once_t bufferKeyOnce = PTHREAD_ONCE_INIT;
+static int traceFd = -1;
+static unsigned traceGeneration = 0;
+static uint32_t nextThread = 0;
+static uint64_t traceOffset = 0;  // end of the file's reserved bytes
+static TraceBuffer* buffers = NULL;
+static __thread TraceBuffer* threadBuffer = NULL;
+
+static void* traceMap(size_t bytes) {
+    void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+// The owner appends to its buffer while traceStop may be writing out every
+// thread's tail; both take this flag first, so it is only ever contended
+// at the end of a trace.
+static void lockBuffer(TraceBuffer* buffer) {
+    while (__atomic_exchange_n(&buffer->busy, true, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&buffer->busy, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static void unlockBuffer(TraceBuffer* buffer) {
+    __atomic_store_n(&buffer->busy, false, __ATOMIC_RELEASE);
+}
+
+// Writes the chunk at an offset reserved for it alone, so threads flushing
+// at the same time neither wait for each other nor interleave. Caller holds
+// the buffer.
+static void writeChunk(TraceBuffer* buffer) {
+    if (buffer->chunk.count == 0)
+        return;
+    size_t bytes = sizeof(TraceChunkHeader) + buffer->chunk.count * sizeof(TraceRecord);
+    off_t offset = (off_t)__atomic_fetch_add(&traceOffset, bytes, __ATOMIC_RELAXED);
+    const char* data = (const char*)&buffer->chunk;
+    while (bytes > 0) {
+        ssize_t written = pwrite(traceFd, data, bytes, offset);
+        if (written <= 0) {
+            perror("pwrite in trace writeChunk failed");
+            break;
+        }
+        data += written;
+        offset += written;
+        bytes -= (size_t)written;
+    }
+    buffer->chunk.count = 0;
+}
+
+// thread exit: write out the thread's records and free the buffer for reuse
+static void releaseBuffer(void* arg) {
+    TraceBuffer* buffer = (TraceBuffer*)arg;
+    lockBuffer(buffer);
+    if (__atomic_load_n(&traceActive, __ATOMIC_ACQUIRE) &&
+        buffer->generation == __atomic_load_n(&traceGeneration, __ATOMIC_RELAXED))
+        writeChunk(buffer);
+    unlockBuffer(buffer);
+    pthread_mutex_lock(&traceLock);
+    buffer->inUse = false;
+    pthread_mutex_unlock(&traceLock);
+}
+
+static void createBufferKey(void) {
+    pthread_key_create(&bufferKey, releaseBuffer);
+}
+
+// the calling thread's buffer, taken from the list on its first event
+static TraceBuffer* ownBuffer(void) {
+    TraceBuffer* buffer = threadBuffer;
+    if (buffer != NULL)
+        return buffer;
+
+    pthread_mutex_lock(&traceLock);
+    for (buffer = buffers; buffer != NULL && buffer->inUse; buffer = buffer->next)
+        ;
+    if (buffer == NULL) {
+        buffer = traceMap(sizeof(TraceBuffer));
+        if (buffer == NULL) {
+            pthread_mutex_unlock(&traceLock);
+            return NULL;
+        }
+        buffer->next = buffers;
+        buffers = buffer;
+    }
+    buffer->inUse = true;
+    buffer->chunk.count = 0;
+    buffer->generation = traceGeneration - 1;
+    pthread_mutex_unlock(&traceLock);
+
+    pthread_once(&bufferKeyOnce, createBufferKey);
+    pthread_setspecific(bufferKey, buffer);
+    threadBuffer = buffer;
+    return buffer;
+}
+
+// The clock records are stamped with. A caller that must order an event
+// before work it is about to do reads it first and passes the time along.
+uint64_t traceClock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// time is when the event happened, or 0 for now
+static void append(uint8_t op, uint8_t arg, void* ptr, void* oldPtr, size_t size,
+                   uint64_t time) {
+    TraceBuffer* buffer = ownBuffer();
+    if (buffer == NULL)
+        return;
+
+    lockBuffer(buffer);
+    // traceStop may have run since the caller checked
+    if (!__atomic_load_n(&traceActive, __ATOMIC_ACQUIRE)) {
+        unlockBuffer(buffer);
+        return;
+    }
+    unsigned generation = __atomic_load_n(&traceGeneration, __ATOMIC_RELAXED);
+    if (buffer->generation != generation) {
+        buffer->generation = generation;
+        buffer->chunk.thread = __atomic_fetch_add(&nextThread, 1, __ATOMIC_RELAXED);
+        buffer->chunk.count = 0;
+        buffer->last = 0;
+    }
+
+    uint64_t now = time ? time : traceClock();
+    if (now <= buffer->last)
+        now = buffer->last + 1;
+
+    // a gap the delta cannot hold starts a new chunk
+    if (buffer->chunk.count > 0 && now - buffer->last > UINT32_MAX)
+        writeChunk(buffer);
+    if (buffer->chunk.count == 0) {
+        buffer->chunk.base = now;
+        buffer->last = now;
+    }
+
+    TraceRecord* record = &buffer->records[buffer->chunk.count++];
+    record->op = op;
+    record->arg = arg;
+    record->reserved = 0;
+    record->delta = (uint32_t)(now - buffer->last);
+    record->ptr = (uint64_t)(uintptr_t)ptr;
+    record->oldPtr = (uint64_t)(uintptr_t)oldPtr;
+    record->size = size;
+    buffer->last = now;
+
+    if (buffer->chunk.count == TRACE_BUFFER_RECORDS)
+        writeChunk(buffer);
+    unlockBuffer(buffer);
+}
+
+// Starts writing a new trace to path, replacing the file. Returns false if
+// a trace is already running or the file cannot be created.
+bool traceStart(const char* path) {
+    pthread_mutex_lock(&traceLock);
+    if (traceActive) {
+        pthread_mutex_unlock(&traceLock);
+        return false;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open in traceStart failed");
+        pthread_mutex_unlock(&traceLock);
+        return false;
+    }
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.recordSize = sizeof(TraceRecord);
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        perror("write in traceStart failed");
+        close(fd);
+        pthread_mutex_unlock(&traceLock);
+        return false;
+    }
+
+    traceFd = fd;
+    __atomic_store_n(&traceGeneration, traceGeneration + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&nextThread, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&traceOffset, sizeof(header), __ATOMIC_RELAXED);
+    __atomic_store_n(&traceActive, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&traceLock);
+    return true;
+}
+
+// Writes out every thread's buffered records and closes the trace. Once
+// traceActive is clear, a thread that takes its buffer after this has
+// written it out records nothing more.
+void traceStop(void) {
+    pthread_mutex_lock(&traceLock);
+    if (!traceActive) {
+        pthread_mutex_unlock(&traceLock);
+        return;
+    }
+    __atomic_store_n(&traceActive, false, __ATOMIC_SEQ_CST);
+    for (TraceBuffer* buffer = buffers; buffer != NULL; buffer = buffer->next) {
+        lockBuffer(buffer);
+        if (buffer->generation == traceGeneration)
+            writeChunk(buffer);
+        unlockBuffer(buffer);
+    }
+    close(traceFd);
+    traceFd = -1;
+    pthread_mutex_unlock(&traceLock);
+}
+
+// Starts the trace named by TDMM_TRACE, if set and none is running. It is
+// written out when the process exits.
+void traceInit(void) {
+    static bool stopRegistered = false;
+    const char* path = getenv("TDMM_TRACE");
+    if (path == NULL || *path == '\0' || traceActive)
+        return;
+    if (traceStart(path) && !stopRegistered) {
+        atexit(traceStop);
+        stopRegistered = true;
+    }
+}
+
+// Records an allocation.
+void traceAlloc(uint8_t op, void* ptr, size_t size, uint8_t arg) {
+    if (ptr == NULL)
+        return;
+    append(op, arg, ptr, NULL, size, 0);
+}
+
+// Records a successful resize (or a free, if newPtr is NULL) at time, read
+// from traceClock before oldPtr could be released, or 0 for now.
+void traceRealloc(void* oldPtr, void* newPtr, size_t size, uint64_t time) {
+    append(TRACE_REALLOC, 0, newPtr, oldPtr, newPtr ? size : 0, time);
+}
+
+// Records a free.
+void traceFree(void* ptr) {
+    append(TRACE_FREE, 0, ptr, NULL, 0, 0);
+}
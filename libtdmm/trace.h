@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Binary allocation trace. The file starts with a TraceFileHeader and is
+// followed by chunks, each a TraceChunkHeader and count records of one
+// thread. A record's delta is the time since the thread's previous record
+// in the chunk, or since the chunk's base for the first one, so the
+// absolute time of every event can be rebuilt and the threads' chunks
+// merged back into the order the events happened in. Each thread's
+// timestamps are strictly increasing; across threads they are plain
+// CLOCK_MONOTONIC readings, so a free is still seen before the allocation
+// that reuses its address, and ties are broken by thread.
+//
+// Objects are named by their addresses; the reader turns those into
+// objects, following an object across t_realloc and dropping frees of
+// objects allocated before the trace started.
+
+#define TRACE_MAGIC "TDMMTRC2"
+#define TRACE_BUFFER_RECORDS 4096  // records a thread buffers before writing a chunk
+
+enum {
+    TRACE_MALLOC = 1,
+    TRACE_CALLOC,         // size is the total byte count
+    TRACE_REALLOC,        // ptr is the new address, 0 if size 0 freed it
+    TRACE_ALIGNED,        // arg is log2 of the alignment
+    TRACE_FREE,
+};
+
+typedef struct TraceFileHeader {
+    char magic[8];
+    uint32_t recordSize;  // sizeof(TraceRecord), for readers to check
+    uint32_t reserved;
+} TraceFileHeader;
+
+typedef struct TraceChunkHeader {
+    uint64_t base;        // CLOCK_MONOTONIC ns the first delta counts from
+    uint32_t thread;      // order in which the thread first traced
+    uint32_t count;       // records that follow
+} TraceChunkHeader;
+
+// 32 bytes per event
+typedef struct TraceRecord {
+    uint8_t op;           // TRACE_* value
+    uint8_t arg;
+    uint16_t reserved;
+    uint32_t delta;       // ns since the previous record of the chunk
+    uint64_t ptr;         // the object's address
+    uint64_t oldPtr;      // TRACE_REALLOC: the address it was resized from
+    uint64_t size;        // requested bytes
+} TraceRecord;
+
+extern bool traceActive;  // checked on every call before recording
+
+// Function declarations
+void traceInit(void);
+bool traceStart(const char* path);
+void traceStop(void);
+uint64_t traceClock(void);
+void traceAlloc(uint8_t op, void* ptr, size_t size, uint8_t arg);
+void traceRealloc(void* oldPtr, void* newPtr, size_t size, uint64_t time);
+void traceFree(void* ptr);
+
+#endif
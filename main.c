@@ -3,11 +3,11 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <sched.h>
+#include <pthread.h>
 #include "tdmm.h"      // Contains declarations for t_malloc, t_free, t_init, etc.
-#include "doublell.h"  // Contains the Block and BlockList definitions
 
 // Extern declarations for global variables defined in your allocator source.
-extern BlockList* blockList;
 extern void* mmapRegion;
 
 #define CSV_FILENAME "allocator_report.csv"
@@ -24,48 +24,142 @@ alloc_strat_e get_strategy(const char *str) {
     } else if (strcmp(str, "worst") == 0) {
         strcpy(current_strategy, "WORST_FIT");
         return WORST_FIT;
+    } else if (strcmp(str, "buddy") == 0) {
+        strcpy(current_strategy, "BUDDY");
+        return BUDDY;
     } else if (strcmp(str, "sequential") == 0) {
         strcpy(current_strategy, "SEQUENTIAL");
         return SEQUENTIAL;
     } else if (strcmp(str, "random") == 0) {
         strcpy(current_strategy, "RANDOM");
         return RANDOM;
+    } else if (strcmp(str, "adaptive") == 0) {
+        strcpy(current_strategy, "ADAPTIVE");
+        return ADAPTIVE;
     }
     strcpy(current_strategy, "FIRST_FIT");
     return FIRST_FIT;
 }
 
-// Helper: Compute current memory utilization by iterating over the block list.
-void get_memory_metrics(size_t *totalMemory, size_t *allocatedMemory, int *blockCount) {
-    *totalMemory = 0;
-    *allocatedMemory = 0;
-    *blockCount = 0;
-    Block *current = blockList ? blockList->head : NULL;
-    while (current != NULL) {
-        *totalMemory += current->size;
-        if (!current->free)
-            *allocatedMemory += current->size;
-        (*blockCount)++;
-        current = current->next;
+// Event log. log_event() only copies a fixed-size record into a ring that
+// a background thread drains into the CSV, so the operations being timed
+// are not held up by formatting and file I/O. Only the main thread logs,
+// so the ring needs no lock: each side owns one index and publishes it
+// with a release store.
+#define LOG_RING_RECORDS 4096
+
+typedef struct {
+    const char *event;        // string literals, valid for the whole run
+    const char *operation;
+    size_t size;
+    void *ptr;
+    double op_time;
+    size_t total_memory;
+    size_t allocated_memory;
+    size_t block_count;
+    size_t overhead;
+} event_record_t;
+
+static event_record_t log_ring[LOG_RING_RECORDS];
+static size_t log_head = 0;   // next record to write out, drain thread only
+static size_t log_tail = 0;   // next slot to fill, main thread only
+static int log_stopping = 0;
+static FILE *log_csv = NULL;
+static pthread_t log_thread;
+
+static void write_record(const event_record_t *r) {
+    double utilization = (r->total_memory > 0) ? ((double)r->allocated_memory / r->total_memory) * 100.0 : 0.0;
+    // CSV columns: Strategy, Event, Operation, BlockSize, Pointer, OpTime(s), TotalMemory, AllocatedMemory, Utilization(%), BlockCount, OverheadBytes
+    fprintf(log_csv, "%s,%s,%s,%zu,%p,%.8f,%zu,%zu,%.2f,%zu,%zu\n",
+            current_strategy, r->event, r->operation, r->size, r->ptr, r->op_time,
+            r->total_memory, r->allocated_memory, utilization, r->block_count, r->overhead);
+}
+
+static void *drain_log(void *arg) {
+    (void)arg;
+    for (;;) {
+        // read the flag first: once it is set, the tail is final
+        int stopping = __atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE);
+        size_t tail = __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE);
+        if (log_head == tail) {
+            if (stopping)
+                break;
+            struct timespec pause = { 0, 1000000 };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        size_t head = log_head;
+        for (; head != tail; head++)
+            write_record(&log_ring[head % LOG_RING_RECORDS]);
+        __atomic_store_n(&log_head, head, __ATOMIC_RELEASE);
     }
+    return NULL;
+}
+
+// Starts the drain thread writing to csv. Returns 0 on success.
+int start_logger(FILE *csv) {
+    log_csv = csv;
+    return pthread_create(&log_thread, NULL, drain_log, NULL);
+}
+
+// Writes out everything still in the ring and closes the CSV.
+void stop_logger(void) {
+    __atomic_store_n(&log_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+    fclose(log_csv);
 }
 
 // Helper: Log an event to the CSV file.
-// This now includes a new column "OverheadBytes".
-void log_event(FILE *csv, const char *event, const char *operation, size_t size, void *ptr, double opTime) {
-    size_t totalMemory = 0, allocatedMemory = 0;
-    int blockCount = 0;
-    get_memory_metrics(&totalMemory, &allocatedMemory, &blockCount);
-    double utilization = (totalMemory > 0) ? ((double)allocatedMemory / totalMemory) * 100.0 : 0.0;
-    
-    // Calculate overhead as the size of BlockList plus each Block's overhead.
-    size_t overhead = sizeof(BlockList) + blockCount * sizeof(Block);
-    
-    // CSV columns: Strategy, Event, Operation, BlockSize, Pointer, OpTime(s), TotalMemory, AllocatedMemory, Utilization(%), BlockCount, OverheadBytes
-    fprintf(csv, "%s,%s,%s,%zu,%p,%.8f,%zu,%zu,%.2f,%d,%zu\n",
-            current_strategy, event, operation, size, ptr, opTime,
-            totalMemory, allocatedMemory, utilization, blockCount, overhead);
-    fflush(csv);
+// The memory figures come from t_stats, which the allocator keeps current,
+// so logging costs the same however many blocks the heap holds.
+void log_event(const char *event, const char *operation, size_t size, void *ptr, double opTime) {
+    size_t tail = log_tail;
+    // a full ring waits for the drain thread rather than dropping events
+    while (tail - __atomic_load_n(&log_head, __ATOMIC_ACQUIRE) == LOG_RING_RECORDS)
+        sched_yield();
+
+    struct t_stats stats;
+    t_stats(&stats);
+    event_record_t *r = &log_ring[tail % LOG_RING_RECORDS];
+    r->event = event;
+    r->operation = operation;
+    r->size = size;
+    r->ptr = ptr;
+    r->op_time = opTime;
+    r->total_memory = stats.heap_bytes;
+    r->allocated_memory = stats.allocated_bytes;
+    r->block_count = stats.block_count;
+    r->overhead = stats.overhead_bytes;
+    __atomic_store_n(&log_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Frees a block from another thread, which has an arena of its own when
+// there is more than one, so the owner sees it as a remote free.
+static void *free_from_thread(void *ptr) {
+    t_free(ptr);
+    return NULL;
+}
+
+// What ADAPTIVE settled on for each size class it saw, and its switches.
+static void print_adaptive(void) {
+    static const char *policies[] = { "first", "best", "worst" };
+    struct t_adaptive adaptive;
+    t_adaptive_stats(&adaptive);
+    printf("Adaptive placement, %zu switches:\n", adaptive.switches);
+    for (int i = 0; i < T_ADAPT_CLASSES; i++) {
+        const struct t_adapt_class *c = &adaptive.classes[i];
+        if (c->allocs == 0)
+            continue;
+        printf("  %8zu+ bytes: %6zu allocs %6zu frees, arenas first/best/worst %u/%u/%u, ns/alloc %.0f/%.0f/%.0f\n",
+               (size_t)1 << i, c->allocs, c->frees, c->arenas[0], c->arenas[1], c->arenas[2],
+               c->cost[0], c->cost[1], c->cost[2]);
+    }
+    struct t_adapt_decision log[8];
+    size_t n = t_adaptive_decisions(log, 8);
+    for (size_t i = 0; i < n; i++)
+        printf("  switch %llu: arena %u class %u %s -> %s (%.0f -> %.0f ns)\n",
+               log[i].sequence, log[i].arena, log[i].size_class,
+               policies[log[i].from], policies[log[i].to], log[i].from_cost, log[i].to_cost);
 }
 
 int main(int argc, char *argv[]) {
@@ -80,6 +174,11 @@ int main(int argc, char *argv[]) {
     }
     // Write CSV header (include the OverheadBytes column).
     fprintf(csv, "Strategy,Event,Operation,BlockSize,Pointer,OpTime(s),TotalMemory,AllocatedMemory,Utilization(%%),BlockCount,OverheadBytes\n");
+    if (start_logger(csv) != 0) {
+        fprintf(stderr, "Failed to start the event logger\n");
+        fclose(csv);
+        return EXIT_FAILURE;
+    }
 
     // Determine allocation strategy from command-line argument.
     alloc_strat_e strategy = FIRST_FIT;
@@ -97,11 +196,53 @@ int main(int argc, char *argv[]) {
     t_init(strategy);
     clock_t initEnd = clock();
     double initTime = (double)(initEnd - initStart) / CLOCKS_PER_SEC;
-    log_event(csv, "Initialization", "t_init", 0, mmapRegion, initTime);
+    log_event("Initialization", "t_init", 0, mmapRegion, initTime);
 
     clock_t start, end;
     double opTime;
 
+    // ---------------------------
+    // Calloc Test (a dirtied block reused through the thread cache)
+    // ---------------------------
+    // A pending remote free sends the next allocation down the locked path,
+    // which must not trust a cached block to still be zero.
+    printf("Calloc Test: Reusing a dirtied %d-byte block...\n", 512);
+    void *dirty = t_malloc(512);
+    void *remote = t_malloc(512);
+    if (!dirty || !remote) {
+        fprintf(stderr, "Calloc test: Allocation of 512 bytes failed.\n");
+        stop_logger();
+        return EXIT_FAILURE;
+    }
+    memset(dirty, 'D', 512);
+    t_free(dirty);
+    pthread_t freer;
+    if (pthread_create(&freer, NULL, free_from_thread, remote) != 0) {
+        fprintf(stderr, "Calloc test: pthread_create failed.\n");
+        stop_logger();
+        return EXIT_FAILURE;
+    }
+    pthread_join(freer, NULL);
+    start = clock();
+    unsigned char *zeroed = t_calloc(512, 1);
+    end = clock();
+    opTime = (double)(end - start) / CLOCKS_PER_SEC;
+    if (!zeroed) {
+        fprintf(stderr, "Calloc test: Allocation of 512 bytes failed.\n");
+        stop_logger();
+        return EXIT_FAILURE;
+    }
+    log_event("Allocation", "t_calloc", 512, zeroed, opTime);
+    for (int i = 0; i < 512; i++) {
+        if (zeroed[i] != 0) {
+            fprintf(stderr, "Calloc test: Byte %d of a calloc'd block is not zero.\n", i);
+            stop_logger();
+            return EXIT_FAILURE;
+        }
+    }
+    t_free(zeroed);
+    printf("Calloc Test: Block at %p is zero\n", (void *)zeroed);
+
     // ---------------------------
     // Sequential Allocation Tests
     // ---------------------------
@@ -113,11 +254,11 @@ int main(int argc, char *argv[]) {
     opTime = (double)(end - start) / CLOCKS_PER_SEC;
     if (!p1) {
         fprintf(stderr, "Allocation of 100 bytes failed.\n");
-        fclose(csv);
+        stop_logger();
         return EXIT_FAILURE;
     }
     memset(p1, 'A', 100);
-    log_event(csv, "Allocation", "t_malloc", 100, p1, opTime);
+    log_event("Allocation", "t_malloc", 100, p1, opTime);
     printf("Allocated 100 bytes at %p\n", p1);
 
     // Test 2: Allocate 200 bytes.
@@ -127,11 +268,11 @@ int main(int argc, char *argv[]) {
     opTime = (double)(end - start) / CLOCKS_PER_SEC;
     if (!p2) {
         fprintf(stderr, "Allocation of 200 bytes failed.\n");
-        fclose(csv);
+        stop_logger();
         return EXIT_FAILURE;
     }
     memset(p2, 'B', 200);
-    log_event(csv, "Allocation", "t_malloc", 200, p2, opTime);
+    log_event("Allocation", "t_malloc", 200, p2, opTime);
     printf("Allocated 200 bytes at %p\n", p2);
 
     // Test 3: Free the first block.
@@ -139,7 +280,7 @@ int main(int argc, char *argv[]) {
     t_free(p1);
     end = clock();
     opTime = (double)(end - start) / CLOCKS_PER_SEC;
-    log_event(csv, "Deallocation", "t_free", 100, p1, opTime);
+    log_event("Deallocation", "t_free", 100, p1, opTime);
     printf("Freed block at %p\n", p1);
 
     // Test 4: Allocate 50 bytes (to potentially reuse the freed space).
@@ -149,11 +290,11 @@ int main(int argc, char *argv[]) {
     opTime = (double)(end - start) / CLOCKS_PER_SEC;
     if (!p3) {
         fprintf(stderr, "Allocation of 50 bytes failed.\n");
-        fclose(csv);
+        stop_logger();
         return EXIT_FAILURE;
     }
     memset(p3, 'C', 50);
-    log_event(csv, "Allocation", "t_malloc", 50, p3, opTime);
+    log_event("Allocation", "t_malloc", 50, p3, opTime);
     printf("Allocated 50 bytes at %p (possibly reusing freed space)\n", p3);
 
     // Free remaining blocks.
@@ -161,14 +302,14 @@ int main(int argc, char *argv[]) {
     t_free(p2);
     end = clock();
     opTime = (double)(end - start) / CLOCKS_PER_SEC;
-    log_event(csv, "Deallocation", "t_free", 200, p2, opTime);
+    log_event("Deallocation", "t_free", 200, p2, opTime);
     printf("Freed block at %p\n", p2);
 
     start = clock();
     t_free(p3);
     end = clock();
     opTime = (double)(end - start) / CLOCKS_PER_SEC;
-    log_event(csv, "Deallocation", "t_free", 50, p3, opTime);
+    log_event("Deallocation", "t_free", 50, p3, opTime);
     printf("Freed block at %p\n", p3);
 
     // Additional Test: Allocate and free multiple blocks sequentially.
@@ -183,11 +324,11 @@ int main(int argc, char *argv[]) {
         opTime = (double)(end - start) / CLOCKS_PER_SEC;
         if (!blocks[i]) {
             fprintf(stderr, "Allocation failed for block %d (size %zu bytes).\n", i, size);
-            fclose(csv);
+            stop_logger();
             return EXIT_FAILURE;
         }
         memset(blocks[i], '0' + (i % 10), size);
-        log_event(csv, "Allocation", "t_malloc", size, blocks[i], opTime);
+        log_event("Allocation", "t_malloc", size, blocks[i], opTime);
         printf("Allocated block %d of size %zu bytes at %p\n", i, size, blocks[i]);
     }
     for (int i = 0; i < NUM_BLOCKS; i++) {
@@ -195,7 +336,7 @@ int main(int argc, char *argv[]) {
         t_free(blocks[i]);
         end = clock();
         opTime = (double)(end - start) / CLOCKS_PER_SEC;
-        log_event(csv, "Deallocation", "t_free", (i + 1) * 10, blocks[i], opTime);
+        log_event("Deallocation", "t_free", (i + 1) * 10, blocks[i], opTime);
         printf("Freed block %d at %p\n", i, blocks[i]);
     }
 
@@ -215,12 +356,12 @@ int main(int argc, char *argv[]) {
             continue;
         }
         memset(ptr, 0, size);
-        log_event(csv, "Allocation", "t_malloc", size, ptr, opTime);
+        log_event("Allocation", "t_malloc", size, ptr, opTime);
         start = clock();
         t_free(ptr);
         end = clock();
         opTime = (double)(end - start) / CLOCKS_PER_SEC;
-        log_event(csv, "Deallocation", "t_free", size, ptr, opTime);
+        log_event("Deallocation", "t_free", size, ptr, opTime);
         printf("Performance test: Allocated and freed %zu bytes in %.8f seconds\n", size, opTime);
     }
 
@@ -238,11 +379,11 @@ int main(int argc, char *argv[]) {
         opTime = (double)(end - start) / CLOCKS_PER_SEC;
         if (!randomBlocks[i]) {
             fprintf(stderr, "Random allocation test: Allocation failed for block %d (size %zu bytes).\n", i, size);
-            fclose(csv);
+            stop_logger();
             return EXIT_FAILURE;
         }
         memset(randomBlocks[i], 'a' + (i % 26), size);
-        log_event(csv, "Allocation", "t_malloc", size, randomBlocks[i], opTime);
+        log_event("Allocation", "t_malloc", size, randomBlocks[i], opTime);
         printf("Allocated random block %d of size %zu bytes at %p\n", i, size, randomBlocks[i]);
     }
     // Shuffle the indices using Fisher–Yates.
@@ -263,7 +404,7 @@ int main(int argc, char *argv[]) {
         end = clock();
         opTime = (double)(end - start) / CLOCKS_PER_SEC;
         size_t size = (idx + 1) * 15;
-        log_event(csv, "Deallocation", "t_free", size, randomBlocks[idx], opTime);
+        log_event("Deallocation", "t_free", size, randomBlocks[idx], opTime);
         printf("Freed random block %d (index %d) at %p\n", i, idx, randomBlocks[idx]);
     }
 
@@ -288,7 +429,7 @@ int main(int argc, char *argv[]) {
             }
             memset(p, 'X', size);
             mixedBlocks[mixedCount++] = p;
-            log_event(csv, "Allocation", "t_malloc", size, p, opTime);
+            log_event("Allocation", "t_malloc", size, p, opTime);
             printf("Mixed Test: Allocated %zu bytes at %p\n", size, p);
         } else {
             // Free a random block from those allocated.
@@ -297,7 +438,7 @@ int main(int argc, char *argv[]) {
             t_free(mixedBlocks[idx]);
             end = clock();
             opTime = (double)(end - start) / CLOCKS_PER_SEC;
-            log_event(csv, "Deallocation", "t_free", 0, mixedBlocks[idx], opTime);
+            log_event("Deallocation", "t_free", 0, mixedBlocks[idx], opTime);
             printf("Mixed Test: Freed block at %p\n", mixedBlocks[idx]);
             // Remove the freed block by replacing it with the last element.
             mixedBlocks[idx] = mixedBlocks[--mixedCount];
@@ -309,11 +450,95 @@ int main(int argc, char *argv[]) {
         t_free(mixedBlocks[i]);
         end = clock();
         opTime = (double)(end - start) / CLOCKS_PER_SEC;
-        log_event(csv, "Deallocation", "t_free", 0, mixedBlocks[i], opTime);
+        log_event("Deallocation", "t_free", 0, mixedBlocks[i], opTime);
         printf("Mixed Test: Freed remaining block at %p\n", mixedBlocks[i]);
     }
 
+    // -------------------------
+    // Heap Test (separate heap, destroyed in one call)
+    // -------------------------
+    #define NUM_HEAP_BLOCKS 100
+    struct t_heap *heap = t_heap_create(strategy, NULL);
+    if (!heap) {
+        fprintf(stderr, "Heap test: t_heap_create failed.\n");
+        stop_logger();
+        return EXIT_FAILURE;
+    }
+    printf("Heap Test: Allocating %d blocks from a separate heap...\n", NUM_HEAP_BLOCKS);
+    for (int i = 0; i < NUM_HEAP_BLOCKS; i++) {
+        size_t size = (size_t)(i + 1) * 64;
+        start = clock();
+        void *p = t_heap_malloc(heap, size);
+        end = clock();
+        opTime = (double)(end - start) / CLOCKS_PER_SEC;
+        if (!p) {
+            fprintf(stderr, "Heap test: Allocation of %zu bytes failed.\n", size);
+            stop_logger();
+            return EXIT_FAILURE;
+        }
+        memset(p, 'H', size);
+        log_event("Allocation", "t_heap_malloc", size, p, opTime);
+        // every other block is freed now, the rest go with the heap
+        if (i % 2) {
+            t_heap_free(heap, p);
+            log_event("Deallocation", "t_heap_free", size, p, 0);
+        }
+    }
+    start = clock();
+    t_heap_destroy(heap);
+    end = clock();
+    opTime = (double)(end - start) / CLOCKS_PER_SEC;
+    log_event("Deallocation", "t_heap_destroy", 0, heap, opTime);
+    printf("Heap Test: Destroyed the heap with %d blocks still allocated\n", NUM_HEAP_BLOCKS / 2);
+
+    // -------------------------
+    // Arena Test (bump allocation, freed by resetting to a mark)
+    // -------------------------
+    #define NUM_ARENA_REQUESTS 10
+    #define ARENA_ALLOCS_PER_REQUEST 1000
+    struct t_arena *arena = t_arena_create(0);
+    if (!arena) {
+        fprintf(stderr, "Arena test: t_arena_create failed.\n");
+        stop_logger();
+        return EXIT_FAILURE;
+    }
+    struct t_arena_mark request_start = t_arena_mark(arena);
+    printf("Arena Test: %d requests of %d bump allocations each...\n",
+           NUM_ARENA_REQUESTS, ARENA_ALLOCS_PER_REQUEST);
+    for (int r = 0; r < NUM_ARENA_REQUESTS; r++) {
+        start = clock();
+        for (int i = 0; i < ARENA_ALLOCS_PER_REQUEST; i++) {
+            size_t size = (size_t)(i % 100) + 1;
+            void *p = t_arena_alloc(arena, size);
+            if (!p) {
+                fprintf(stderr, "Arena test: Allocation of %zu bytes failed.\n", size);
+                stop_logger();
+                return EXIT_FAILURE;
+            }
+            memset(p, 'A', size);
+        }
+        t_arena_reset(arena, request_start);
+        end = clock();
+        opTime = (double)(end - start) / CLOCKS_PER_SEC;
+        log_event("Allocation", "t_arena_alloc", ARENA_ALLOCS_PER_REQUEST, arena, opTime);
+    }
+    t_arena_destroy(arena);
+    printf("Arena Test: Done, every request freed by one reset\n");
+
     printf("Memory allocation tests completed successfully.\n");
-    fclose(csv);
+    struct t_stats stats;
+    t_stats(&stats);
+    printf("Mapped bytes: %zu (peak %zu), huge-page backed: %zu\n",
+           stats.mapped_bytes, stats.peak_mapped_bytes, stats.huge_page_bytes);
+    printf("System calls: mmap %zu, munmap %zu, mremap %zu, madvise %zu, mprotect %zu\n",
+           stats.mmap_calls, stats.munmap_calls, stats.mremap_calls,
+           stats.madvise_calls, stats.mprotect_calls);
+    struct t_frag frag;
+    t_frag_stats(&frag);
+    printf("Free blocks: %zu, %zu bytes, largest %zu, fragmentation index %.3f\n",
+           frag.free_block_count, frag.free_bytes, frag.largest_free, frag.fragmentation);
+    if (strategy == ADAPTIVE)
+        print_adaptive();
+    stop_logger();
     return EXIT_SUCCESS;
 }